@@ -0,0 +1,36 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "racetrack.h"
+
+/**
+     * explores all states that the safeguard controller reaches from the start positions, with
+     * the state space sharded by position tiles across nworkers processes that each load their
+     * own model, and returns 1 if no reachable state crashes and 0 otherwise
+     *
+     * unless checkpoint_path is NULL, the visited states and their verdicts are saved there every
+     * checkpoint_interval seconds and at the end, and resume continues with the visited states
+     * that have no verdict yet
+     */
+int run_sharded_analysis(const Map *map, const char *nn_model_directory, int nworkers,
+                         int look_ahead_steps, int safety_distance, const char *checkpoint_path,
+                         int checkpoint_interval, int resume);
+
+/**
+     * certifies boxes of states with interval bound propagation through the features, the network
+     * and the safeguard, splits boxes where the decision of the network is ambiguous and falls
+     * back to concrete execution for single states, returns 1 if no state crashes in one step
+     */
+int run_abstract_analysis(const Map *map, const char *nn_model_directory, int look_ahead_steps,
+                          int safety_distance);
+
+/**
+     * evaluates several models on batches of all states of the map, where the features and the
+     * successors are computed once per state, reports the share of states in which the action of
+     * each network alone does not crash in one step and writes the states in which the networks
+     * disagree to a file starting with output_prefix unless it is NULL, returns 1 unless a model
+     * cannot be run or the file cannot be written
+     */
+int run_model_comparison(const Map *map, char **nn_model_directories, int nmodels, const char *output_prefix);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include "racetrack.h"
+
+/*
+ * A dataset file starts with a header of DATASET_HEADER_SIZE bytes, whose first eight 64 bit
+ * integers are the magic number, the version, the number of columns, the number of rows per chunk,
+ * the number of chunks, the number of rows and the offset of the row counts, followed by zeros.
+ * The magic number is only written once the file is complete.
+ *
+ * Chunk k starts at DATASET_HEADER_SIZE + k * DATASET_COLUMNS * DATASET_CHUNK_ROWS * 4 and stores
+ * the columns one after the other, each as DATASET_CHUNK_ROWS 32 bit values, so every column of a
+ * chunk can be used in place after mapping the file. All columns are floats except for
+ * DATASET_EPISODE and DATASET_STEP, which are 32 bit signed integers. The number of rows of each
+ * chunk is stored as a 64 bit integer at the offset of the row counts, rows beyond it are zero.
+ * Chunks are written by several threads, so their order is not specified.
+ */
+
+#define DATASET_MAGIC 0x5452414345534554L
+#define DATASET_VERSION 1
+#define DATASET_HEADER_SIZE 4096
+#define DATASET_CHUNK_ROWS 4096
+
+/* first of the 14 columns of the feature values */
+#define DATASET_FEATURES 0
+/* first of the 9 columns of the Q-values, column i belongs to the acceleration (i / 3 - 1, i % 3 - 1) */
+#define DATASET_Q_VALUES 14
+/* acceleration chosen by the network, x and y */
+#define DATASET_ACTION 23
+/* acceleration chosen by the safeguard, x and y */
+#define DATASET_SAFEGUARDED_ACTION 25
+/* episode index and step of the state as 32 bit signed integers, -1 for a sweep over the state space */
+#define DATASET_EPISODE 27
+#define DATASET_STEP 28
+#define DATASET_COLUMNS 29
+
+/**
+     * writes a row for every state on the track, or with a positive nepisodes for every decision
+     * of the safeguard controller in nepisodes episodes from random start positions, to the dataset
+     * file at the specified path. The rows are computed by nthreads threads that fill a chunk each
+     * and write it to its own place in the file. Returns 1 on success and 0 on failure.
+     */
+int run_dataset_export(const Map *map, const char *nn_model_directory, const char *filename, int nthreads,
+                       long nepisodes, unsigned long seed, int step_limit, int look_ahead_steps,
+                       int safety_distance);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include "racetrack.h"
+
+/**
+     * generates a map with a border of walls and a track that is carved by a square of the
+     * specified corridor width moving randomly through the map, turning with the specified
+     * probability per cell. The specified fraction of the track cells beside the path of the
+     * square are turned into walls. The first cells of the path become start positions and the
+     * last cells goal positions, and since the path has no obstacles, every goal is reachable from
+     * every start. Returns NULL if the parameters are invalid or the path is too short for the
+     * starts and goals.
+     */
+Map *generate_map(int width, int height, int corridor_width, double turn_density, double obstacle_fraction,
+                  int nstarts, int ngoals, unsigned long seed);
+
+/**
+     * generates maps of the specified parameters whose area doubles nsizes times, starting from
+     * the specified size, and prints a csv line for each map with the time to generate, write and
+     * load it, the throughput of feature extraction, collision checks and state space exploration,
+     * the size of the map in memory and the maximal resident set size of the process
+     */
+int run_map_benchmark(int width, int height, int corridor_width, double turn_density, double obstacle_fraction,
+                      int nstarts, int ngoals, unsigned long seed, int nsizes);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/* number of sub-buckets per power of two is 2^LATENCY_SUB_BITS, i.e., below 1% relative error */
+#define LATENCY_SUB_BITS 7
+
+typedef struct LatencyHistogram LatencyHistogram;
+
+/**
+     * creates an empty histogram of latencies in nanoseconds with logarithmic buckets that are
+     * split into linear sub-buckets
+     */
+LatencyHistogram *create_latency_histogram();
+
+/**
+     * adds a latency in nanoseconds to the histogram
+     */
+void record_latency(LatencyHistogram *histogram, long latency);
+
+/**
+     * computes the latency below which the specified fraction of the recorded latencies fall,
+     * accurate up to the width of a sub-bucket
+     */
+long get_latency_percentile(const LatencyHistogram *histogram, double fraction);
+
+long get_latency_count(const LatencyHistogram *histogram);
+
+long get_latency_max(const LatencyHistogram *histogram);
+
+/**
+     * adds all latencies of the source histogram to the destination histogram
+     */
+void merge_latency_histogram(LatencyHistogram *destination, const LatencyHistogram *source);
+
+void reset_latency_histogram(LatencyHistogram *histogram);
+
+void delete_latency_histogram(LatencyHistogram *histogram);
+
+#endif
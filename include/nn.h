@@ -9,11 +9,23 @@ typedef struct NNModel NNModel;
 
 typedef struct NNInput NNInput;
 
+typedef struct NNContext NNContext;
+
+typedef struct NNWeights NNWeights;
+
+typedef struct NNBatch NNBatch;
+
 /**
      * creates a neural network model from saved model format
      */
 NNModel *load_nn_model(const char *filename);
 
+/**
+     * creates a neural network model from saved model format whose session uses the given
+     * number of intra-op and inter-op threads, zero keeps the TensorFlow default
+     */
+NNModel *load_nn_model_with_threads(const char *filename, int intra_op_threads, int inter_op_threads);
+
 /**
      * creates a neural network input from the specified state
      */
@@ -25,8 +37,67 @@ NNInput *get_nn_input(const Map *map, const State *state, const NNModel *nn_mode
      */
 Acceleration *call_nn_model(const NNModel *nn_model, const NNInput *nn_input);
 
+/**
+     * creates an inference context with a preallocated input tensor, a context must only be
+     * used by one thread at a time
+     */
+NNContext *create_nn_context(const NNModel *nn_model);
+
+/**
+     * calls the neural network model of the context on the specified state and returns the
+     * output as an acceleration
+     */
+Acceleration *call_nn_context(NNContext *nn_context, const Map *map, const State *state);
+
+/**
+     * calls the neural network model of the context on the specified state without allocating an
+     * acceleration and returns the index of the maximal Q-value, which belongs to the acceleration
+     * (index / 3 - 1, index % 3 - 1), or -1 on failure
+     */
+int get_nn_context_action(NNContext *nn_context, const Map *map, const State *state);
+
 void delete_nn_model(NNModel *nn_model);
 
 void delete_nn_input(NNInput *nn_input);
 
+/**
+     * extracts the dense layers of a neural network model, returns NULL if the network contains
+     * operations other than dense layers with optional ReLU activations
+     */
+NNWeights *get_nn_weights(const NNModel *nn_model);
+
+/**
+     * propagates intervals of input values through the dense layers (interval bound propagation)
+     * and computes bounds of the output values, a weights object must only be used by one thread
+     * at a time
+     */
+void call_nn_weights(const NNWeights *nn_weights, const double *lower, const double *upper,
+                     double *q_lower, double *q_upper);
+
+/**
+     * creates an input tensor for up to capacity states that can be passed to several models
+     */
+NNBatch *create_nn_batch(int capacity);
+
+/**
+     * returns the feature values of the batch, INPUT_SIZE values per state
+     */
+float *get_nn_batch_input(NNBatch *nn_batch);
+
+/**
+     * returns the Q-values of the last call, OUTPUT_SIZE values per state
+     */
+const float *get_nn_batch_output(const NNBatch *nn_batch);
+
+/**
+     * calls a neural network model on the first nstates states of the batch, returns 0 on failure
+     */
+int call_nn_batch(const NNModel *nn_model, NNBatch *nn_batch, int nstates);
+
+void delete_nn_context(NNContext *nn_context);
+
+void delete_nn_batch(NNBatch *nn_batch);
+
+void delete_nn_weights(NNWeights *nn_weights);
+
 #endif
\ No newline at end of file
@@ -52,6 +52,11 @@ void print_state(const Map *map, const State *state);
      */
 Distance *get_goal_distance(const Map *map, const Position *position);
 
+/**
+     * computes the goal distance into the specified distance
+     */
+void fill_goal_distance(const Map *map, const Position *position, Distance *goal_distance);
+
 /**
      * creates a negated acceleration
      */
@@ -92,8 +97,29 @@ void delete_state(State *state);
 
 Map *get_map();
 
+/**
+     * reads a map in track format, i.e., a line "dim: width height" followed by width lines of height
+     * cells, and returns NULL if the file is malformed
+     */
+Map *read_map(FILE *file);
+
+/**
+     * reads a map from a file in track format
+     */
+Map *load_map(const char *filename);
+
+/**
+     * writes a map in track format and returns 0 on failure
+     */
+int write_map(const Map *map, FILE *file);
+
 float *get_feature_values(const Map *map, const State *state);
 
+/**
+     * writes the feature values of a state into the specified array
+     */
+void fill_feature_values(const Map *map, const State *state, float *feature_values);
+
 const int velocity_to_traversed_positions[6][6][6][6] =
 {{{{1, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}},
      {{1, 1, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}},
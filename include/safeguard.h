@@ -9,4 +9,35 @@
 int run_safeguard_controller(const Map *map, const State *initial_state,
                              const char *nn_model_directory, int step_limit, int look_ahead_steps, int safety_distance);
 
+/**
+     * runs the safeguard controller with a look ahead that is deepened while the budget of a
+     * decision in nanoseconds allows, prints the decision latencies and returns 1 if a goal state
+     * is reached and 0 on failure
+     *
+     * the look ahead checks at most look_ahead_steps steps and stops at a goal state. The action
+     * of the network is checked first, then its negation and then the remaining actions, and the
+     * first action that passes or is not refuted when the budget runs out is taken. If every
+     * action crashes, the one that crashes last is taken. Below one look ahead step the action of
+     * the network is taken unchecked, as in the fixed safeguard.
+     */
+int run_anytime_safeguard_controller(const Map *map, const State *initial_state,
+                                     const char *nn_model_directory, int step_limit, int look_ahead_steps,
+                                     long budget);
+
+/**
+     * runs episodes from random start positions on nthreads threads that share one model, records
+     * visits, fallbacks, crashes and goals per cell, writes them to files starting with
+     * statistics_prefix unless it is NULL, and returns 1 if every episode succeeds
+     *
+     * a positive budget in nanoseconds replaces the fixed look ahead by the anytime safeguard, the
+     * decision latencies are summarized and, with a statistics_prefix, listed per episode
+     *
+     * unless checkpoint_path is NULL, the progress is saved there every checkpoint_interval
+     * seconds and at the end, and resume continues from the saved progress
+     */
+int run_parallel_evaluation(const Map *map, const char *nn_model_directory, int nthreads, long nepisodes,
+                            unsigned long seed, int step_limit, int look_ahead_steps, int safety_distance,
+                            long budget, const char *statistics_prefix, const char *checkpoint_path,
+                            int checkpoint_interval, int resume);
+
 #endif
\ No newline at end of file
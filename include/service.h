@@ -0,0 +1,25 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include "racetrack.h"
+
+/* maximal number of states in a single service request */
+#define SERVICE_BATCH_LIMIT 1024
+/* maximal number of connections that are served at the same time */
+#define SERVICE_CONNECTION_LIMIT 64
+
+/**
+     * keeps the map and the models resident and answers requests on a Unix domain socket until
+     * the process is terminated, returns 0 if the service cannot be started or the path names a
+     * file that is not a socket. Each connection is served by its own thread, and clients beyond
+     * SERVICE_CONNECTION_LIMIT open connections wait until a connection is closed.
+     *
+     * a request is a 32 bit length of the remaining bytes, a 32 bit model index and up to
+     * SERVICE_BATCH_LIMIT states of four 32 bit integers (x, y, vx, vy), all in host byte order;
+     * the response is a 32 bit length followed by three 32 bit integers (status, ax, ay) per
+     * state, where status is 1 for the safeguarded acceleration and 0 for an invalid state
+     */
+int run_controller_service(const Map *map, const char *socket_path, char **nn_model_directories,
+                           int nmodels, int look_ahead_steps, int safety_distance);
+
+#endif
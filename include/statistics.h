@@ -0,0 +1,42 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include "racetrack.h"
+
+/* velocity buckets are the maximum norm of the velocity */
+#define VELOCITY_BUCKETS 6
+
+#define STATISTICS_VISITS 0
+#define STATISTICS_FALLBACKS 1
+#define STATISTICS_CRASHES 2
+#define STATISTICS_GOALS 3
+#define STATISTICS_COUNTERS 4
+
+typedef struct Statistics Statistics;
+
+/**
+     * creates counters for every cell and velocity bucket of the map, split into nshards copies
+     * so that threads recording into different shards do not contend
+     */
+Statistics *create_statistics(const Map *map, int nshards);
+
+/**
+     * increments a counter of the cell and velocity bucket of a state, does nothing if the
+     * statistics are NULL
+     */
+void record_statistics(Statistics *statistics, int shard, const State *state, int counter);
+
+/**
+     * computes the sum of a counter over all shards
+     */
+unsigned long get_statistics(const Statistics *statistics, int x, int y, int bucket, int counter);
+
+/**
+     * writes one file per counter with the per cell totals in the layout of the map csv files, and all
+     * counters per velocity bucket to a binary file, returns 0 on failure
+     */
+int write_statistics(const Statistics *statistics, const char *prefix);
+
+void delete_statistics(Statistics *statistics);
+
+#endif
@@ -2,19 +2,103 @@
 #include <stdlib.h>
 #include <tensorflow/c/c_api.h>
 #include <string.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "../include/maps.h"
 #include "../include/racetrack.h"
 #include "../include/safeguard.h"
 #include "../include/nn.h"
+#include "../include/analysis.h"
+#include "../include/service.h"
+#include "../include/statistics.h"
+#include "../include/latency.h"
+#include "../include/generator.h"
+#include "../include/dataset.h"
 
 #define INPUT_SIZE 14
 #define OUTPUT_SIZE 9
 
+/* side length of the position tiles that are assigned to analysis workers */
+#define TILE_SIZE 8
+/* number of slots in the successor ring buffer of an analysis worker (power of two) */
+#define RING_CAPACITY (1 << 16)
+
+/* verdicts of the sharded analysis */
+#define VERDICT_UNKNOWN 0
+#define VERDICT_SAFE 1
+#define VERDICT_CRASH 2
+#define VERDICT_GOAL 3
+
+/* number of per position features, i.e., the wall distances and the goal distances */
+#define CELL_FEATURES 10
+/* slack of interval bounds that covers float rounding in TensorFlow, relative to the sum of the
+   magnitudes of the terms of a pre-activation */
+#define BOUND_SLACK 1e-4
+
+/* outcomes of the abstract safeguard on a box */
+#define BOX_UNKNOWN 0
+#define BOX_SAFE 1
+
+/* identifies checkpoint files of the parallel evaluation */
+#define CHECKPOINT_MAGIC 0x33304b4350435452L
+#define CHECKPOINT_FIELDS 15
+/* identifies checkpoint files of the sharded analysis */
+#define ANALYSIS_CHECKPOINT_MAGIC 0x3130534c4e415452L
+#define ANALYSIS_CHECKPOINT_FIELDS 9
+/* initial value of the FNV-1a hashes that identify the model and the map of a checkpoint */
+#define HASH_OFFSET 0xcbf29ce484222325UL
+
+/* number of buckets of a latency histogram */
+#define LATENCY_BUCKETS ((65 - LATENCY_SUB_BITS) << LATENCY_SUB_BITS)
+
+/* number of states whose features are computed and evaluated together by the model comparison */
+#define COMPARISON_BATCH 256
+
+/* result of run_safeguard_episode when the model could not be run, as opposed to a crash */
+#define EPISODE_ERROR -1
+
+/* maximal number of models that can be passed on the command line */
+#define MODEL_LIMIT 16
+
+/* size of a chunk of a dataset file in bytes */
+#define DATASET_CHUNK_SIZE ((long)DATASET_COLUMNS * DATASET_CHUNK_ROWS * sizeof(float))
+
+/* share of the map inside the border that the generator carves before it stops */
+#define GENERATOR_COVERAGE 0.5
+/* number of random states timed by the map benchmark per measurement */
+#define BENCHMARK_SAMPLES (1 << 18)
+/* maximal number of states explored by the map benchmark */
+#define BENCHMARK_EXPLORATION_LIMIT (1 << 22)
+
 const int velocity_limit_x = 5;
 
 const int velocity_limit_y = 5;
 
+/* thread pool sizes of the sessions created by load_nn_model, zero lets TensorFlow decide */
+int nn_intra_op_threads = 0;
+
+int nn_inter_op_threads = 0;
+
+/* skips the look ahead inferences of states that cannot reach a wall within the remaining steps */
+int adaptive_look_ahead = 0;
+
 struct Map
 {
     int width;
@@ -28,6 +112,9 @@ struct Map
     Position **goals;
     /* start positions */
     Position **starts;
+    /* numbers of walls in the rectangles from the origin to each position, with a leading row and
+       column of zeros */
+    int *wall_counts;
 };
 
 struct Position
@@ -66,6 +153,19 @@ struct NNModel
     TF_Graph *graph;
     TF_Session *session;
     TF_Status *status;
+    /* input and output operations, resolved once when the model is loaded */
+    TF_Output input;
+    TF_Output output;
+};
+
+/* per thread inference state, its tensor is refilled in place for every call */
+struct NNContext
+{
+    const NNModel *nn_model;
+    TF_Tensor *input_values[1];
+    TF_Status *status;
+    /* Q-values of the last call */
+    float q_values[OUTPUT_SIZE];
 };
 
 struct NNInput
@@ -73,13 +173,310 @@ struct NNInput
     TF_Tensor **values;
 };
 
+struct RingSlot
+{
+    atomic_size_t sequence;
+    int state_index;
+};
+
+/* batch of inputs that is shared by several models */
+struct NNBatch
+{
+    int capacity;
+    TF_Tensor *input_values[1];
+    TF_Status *status;
+    /* capacity x OUTPUT_SIZE Q-values of the last call */
+    float *q_values;
+};
+
+/* dense layer of a neural network, the kernel is stored row-major as ninputs x noutputs */
+struct DenseLayer
+{
+    int ninputs;
+    int noutputs;
+    float *kernel;
+    float *bias;
+    int relu;
+};
+
+struct NNWeights
+{
+    int nlayers;
+    struct DenseLayer *layers;
+    /* scratch space for interval propagation, sized to the widest layer */
+    double *center;
+    double *radius;
+    double *next_center;
+    double *next_radius;
+    /* sum of the magnitudes |w| * (|c| + r) of the terms of each pre-activation */
+    double *next_magnitude;
+};
+
+/* box of states with inclusive bounds */
+struct StateBox
+{
+    int x_lower, x_upper;
+    int y_lower, y_upper;
+    int vx_lower, vx_upper;
+    int vy_lower, vy_upper;
+};
+
+/* counters per grid cell and velocity bucket, one copy per shard */
+struct Statistics
+{
+    int width;
+    int height;
+    int nshards;
+    /* nshards x width x height x VELOCITY_BUCKETS x STATISTICS_COUNTERS */
+    atomic_ulong *counters;
+};
+
+struct LatencyHistogram
+{
+    long count;
+    long max;
+    long *counts;
+};
+
+/* statistics of one episode, recorded privately and committed when the episode ends */
+struct EpisodeEvent
+{
+    int state_index;
+    int counter;
+};
+
+struct EpisodeTrace
+{
+    int nevents;
+    int size;
+    struct EpisodeEvent *events;
+};
+
+/* shared state of the evaluation threads */
+struct Evaluation
+{
+    const Map *map;
+    const NNModel *nn_model;
+    long nepisodes;
+    unsigned long seed;
+    int step_limit;
+    int look_ahead_steps;
+    int safety_distance;
+    /* time budget of a decision in nanoseconds, zero uses the fixed look ahead */
+    long budget;
+    /* hashes of the resolved model directory and of the map grid */
+    uint64_t model_hash;
+    uint64_t map_hash;
+    Statistics *statistics;
+    /* decision latencies of every episode are merged into the map histogram */
+    LatencyHistogram *latencies;
+    FILE *latency_file;
+    pthread_mutex_t latency_mutex;
+    /* index of the next episode to run */
+    atomic_long next_episode;
+    atomic_long successes;
+    atomic_int failed;
+    int nstates;
+    /* one bit per episode, set when its results are committed */
+    atomic_ulong *completed;
+    /* one bit per state, set when a committed episode visited the state */
+    atomic_ulong *visited;
+    /* held shared while an episode is committed and exclusively while a checkpoint is taken */
+    pthread_rwlock_t commit_lock;
+    const char *checkpoint_path;
+    int checkpoint_interval;
+    pthread_mutex_t checkpoint_mutex;
+    pthread_cond_t checkpoint_condition;
+    int done;
+};
+
+struct EvaluationWorker
+{
+    struct Evaluation *evaluation;
+    int shard;
+};
+
+/* state of a dataset export shared by the exporting threads */
+struct DatasetExport
+{
+    const Map *map;
+    const NNModel *nn_model;
+    int fd;
+    /* number of episodes, zero sweeps over the state space */
+    long nepisodes;
+    unsigned long seed;
+    int step_limit;
+    int look_ahead_steps;
+    int safety_distance;
+    /* index of the next episode, or of the next block of states of a sweep */
+    atomic_long next_item;
+    /* index of the next chunk in the file */
+    atomic_long next_chunk;
+    long chunk_limit;
+    /* number of rows of every chunk */
+    int64_t *chunk_rows;
+    atomic_int failed;
+};
+
+/* chunk of a dataset that is filled by one thread */
+struct DatasetChunk
+{
+    int nrows;
+    float *columns;
+};
+
+/* counters of the abstract analysis */
+struct AbstractResult
+{
+    long certified;
+    long concrete;
+    long crashes;
+    long boxes;
+    long inferences;
+};
+
+/* bounded multi-producer queue of state indices owned by one analysis worker */
+struct Ring
+{
+    atomic_size_t head;
+    atomic_size_t tail;
+    struct RingSlot slots[RING_CAPACITY];
+};
+
+/* analysis state that lives in memory shared by the coordinator and all workers */
+struct SharedAnalysis
+{
+    int nworkers;
+    int nstates;
+    /* number of claimed states that have not been processed yet */
+    atomic_long pending;
+    /* set when a worker cannot take part, since its shard would never drain */
+    atomic_int failed;
+    /* one bit per state, set when a state is claimed for processing */
+    atomic_ulong *visited;
+    /* one verdict per state, published after the successor of the state is claimed */
+    atomic_uchar *verdicts;
+    struct Ring *rings;
+};
+
+/* periodic checkpoint of the sharded analysis, taken by a thread of the coordinator */
+struct AnalysisCheckpoint
+{
+    const Map *map;
+    struct SharedAnalysis *analysis;
+    const char *path;
+    int interval;
+    int look_ahead_steps;
+    int safety_distance;
+    uint64_t model_hash;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    int done;
+};
+
+/* number of open connections of the controller service, bounded by SERVICE_CONNECTION_LIMIT */
+struct ServiceSlots
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    int nconnections;
+};
+
+/* connection of a client of the controller service */
+struct ServiceConnection
+{
+    const Map *map;
+    int fd;
+    NNModel **nn_models;
+    int nmodels;
+    int look_ahead_steps;
+    int safety_distance;
+    struct ServiceSlots *slots;
+};
+
 
-Acceleration *compute_acceleration(const Map *map, const State *state, const NNModel *nn_model,
+Acceleration *compute_acceleration(const Map *map, const State *state, NNContext *nn_context,
                                    int look_ahead_steps, int safety_distance);
 
-int look_ahead_check(const Map *map, const State *state, const NNModel *nn_model,
+int look_ahead_check(const Map *map, const State *state, NNContext *nn_context,
                      int look_ahead_steps, int safety_distance);
 
+int is_look_ahead_safe(const Map *map, const State *state, int look_ahead_steps);
+
+void get_displacement_bounds(int velocity, int look_ahead_steps, int *lower, int *upper);
+
+int is_wall_free(const Map *map, int x_lower, int y_lower, int x_upper, int y_upper);
+
+void set_wall_counts(Map *map);
+
+Map *create_map(int width, int height);
+
+void index_map(Map *map);
+
+void carve_square(Map *map, int x, int y, int corridor_width, int *carved, int *ncarved);
+
+long explore_map(const Map *map, int limit);
+
+double get_time();
+
+void *run_export_worker(void *argument);
+
+Acceleration *export_state(struct DatasetExport *export, struct DatasetChunk *chunk, NNContext *nn_context,
+                           const State *state, long episode, int step);
+
+int flush_chunk(struct DatasetExport *export, struct DatasetChunk *chunk);
+
+int pwrite_fully(int fd, const void *buffer, size_t size, off_t offset);
+
+size_t get_map_size(const Map *map);
+
+Acceleration *compute_safeguarded_acceleration(const Map *map, const State *state, NNContext *nn_context,
+                                               int look_ahead_steps, int safety_distance, int *fallback);
+
+int run_safeguard_episode(const Map *map, const State *initial_state, NNContext *nn_context,
+                          int step_limit, int look_ahead_steps, int safety_distance, long budget,
+                          struct EpisodeTrace *trace, LatencyHistogram *latencies);
+
+Acceleration *compute_anytime_acceleration(const Map *map, const State *state, NNContext *nn_context,
+                                           int look_ahead_steps, long budget, int *fallback);
+
+int check_anytime_action(const Map *map, const State *state, NNContext *nn_context, int action,
+                         int look_ahead_steps, long budget, const struct timespec *start, long *step_time,
+                         int *crashed);
+
+long get_elapsed_time(const struct timespec *start);
+
+int get_latency_index(long latency);
+
+void print_latencies(const LatencyHistogram *histogram);
+
+void record_event(const Map *map, struct EpisodeTrace *trace, const State *state, int counter);
+
+void commit_episode(struct Evaluation *evaluation, struct EpisodeTrace *trace, int shard, long episode,
+                    int success, const LatencyHistogram *latencies);
+
+unsigned long get_random(unsigned long *random_state);
+
+void *run_evaluation_worker(void *argument);
+
+int write_checkpoint(struct Evaluation *evaluation);
+
+int read_checkpoint(struct Evaluation *evaluation);
+
+int replace_file(const char *path, const void **blocks, const size_t *sizes, int nblocks);
+
+int sync_parent_directory(const char *path);
+
+uint64_t get_model_hash(const char *nn_model_directory);
+
+uint64_t get_hash(uint64_t hash, const void *data, size_t size);
+
+uint64_t get_map_hash(const Map *map);
+
+void *run_checkpoint_thread(void *argument);
+
+int get_max_q_value_index(const float *q_values);
+
 int is_valid_acceleration(const Map *map, const State *state, const Acceleration *acceleration);
 
 int is_valid_velocity(const Map *map, const Position *position, const Velocity *velocity);
@@ -94,21 +491,327 @@ Position *get_start_position(const Map *map);
 
 Velocity *get_start_velocity();
 
+int get_state_count(const Map *map);
 
-int main()
-{
-    
-    /* TODO command line interface */
-    char *nn_model_filename = "../policies/corner/";
+int get_state_index(const Map *map, const State *state);
+
+void get_indexed_state(const Map *map, int state_index, Position *position, Velocity *velocity);
+
+int get_shard(const Map *map, const Position *position, int nworkers);
+
+void claim_state(const Map *map, struct SharedAnalysis *analysis, const State *state,
+                 int **overflow, int *noverflow, int *overflow_size);
+
+void enqueue_state(const Map *map, struct SharedAnalysis *analysis, int state_index, const Position *position,
+                   int **overflow, int *noverflow, int *overflow_size);
+
+int run_analysis_worker(const Map *map, struct SharedAnalysis *analysis, int worker,
+                        const char *nn_model_directory, int look_ahead_steps, int safety_distance,
+                        const int *seeds, int nseeds);
+
+int write_analysis_checkpoint(struct AnalysisCheckpoint *checkpoint);
+
+int read_analysis_checkpoint(struct AnalysisCheckpoint *checkpoint);
+
+void *run_analysis_checkpoint_thread(void *argument);
+
+int ring_push(struct Ring *ring, int state_index);
+
+int ring_pop(struct Ring *ring, int *state_index);
+
+int read_fully(int fd, void *buffer, size_t size);
+
+int write_fully(int fd, const void *buffer, size_t size);
+
+void serve_connection(const Map *map, int fd, NNContext **nn_contexts, int nmodels,
+                      int32_t *request, int32_t *response, int look_ahead_steps, int safety_distance);
+
+void *run_service_connection(void *argument);
+
+void release_service_slot(struct ServiceSlots *slots);
 
-    Map *map = get_map();
+float *get_cell_features(const Map *map);
+
+int get_abstract_action(const Map *map, const struct StateBox *box, const float *cell_features,
+                        const NNWeights *nn_weights);
+
+int check_box(const Map *map, const struct StateBox *box, const float *cell_features,
+              const NNWeights *nn_weights, int look_ahead_steps, struct AbstractResult *result);
+
+void analyze_box(const Map *map, const struct StateBox *box, const float *cell_features,
+                 const NNWeights *nn_weights, NNContext *nn_context, int look_ahead_steps,
+                 int safety_distance, struct AbstractResult *result);
+
+TF_Tensor *evaluate_nn_output(const NNModel *nn_model, TF_Output output);
+
+
+int main(int argc, char **argv)
+{
+    char *nn_model_filenames[MODEL_LIMIT] = {"../policies/corner/"};
+    int nmodels = 0;
     int step_limit = 50;
     int look_ahead_steps = 3;
     int safety_distance = 1;
-    State *initial_state = get_intial_state(map);
+    /* number of analysis worker processes, zero runs a single episode */
+    int nworkers = 0;
+    /* socket of the controller service */
+    char *socket_path = NULL;
+    int abstract = 0;
+    /* number of episodes of a parallel evaluation */
+    long nepisodes = 0;
+    int nthreads = 1;
+    unsigned long seed = 0;
+    char *statistics_prefix = NULL;
+    char *checkpoint_path = NULL;
+    int checkpoint_interval = 60;
+    int resume = 0;
+    int compare = 0;
+    /* time budget of a decision in microseconds for the anytime safeguard */
+    long budget = 0;
+    /* track file that replaces the map of maps.h */
+    char *map_filename = NULL;
+    /* size of a generated map, zero generates none */
+    int generate_width = 0;
+    int generate_height = 0;
+    int corridor_width = 3;
+    double turn_density = 0.05;
+    double obstacle_fraction = 0.0;
+    int nstarts = 4;
+    int ngoals = 4;
+    /* number of map sizes of the map benchmark */
+    int nsizes = 0;
+    /* dataset file of an export */
+    char *dataset_filename = NULL;
+
+    static struct option long_options[] = {
+        {"model", required_argument, NULL, 'm'},
+        {"steps", required_argument, NULL, 's'},
+        {"look-ahead", required_argument, NULL, 'l'},
+        {"safety-distance", required_argument, NULL, 'd'},
+        {"workers", required_argument, NULL, 'w'},
+        {"serve", required_argument, NULL, 'S'},
+        {"intra-op-threads", required_argument, NULL, 'I'},
+        {"inter-op-threads", required_argument, NULL, 'O'},
+        {"abstract", no_argument, NULL, 'a'},
+        {"episodes", required_argument, NULL, 'e'},
+        {"threads", required_argument, NULL, 't'},
+        {"seed", required_argument, NULL, 'r'},
+        {"output", required_argument, NULL, 'o'},
+        {"checkpoint", required_argument, NULL, 'c'},
+        {"checkpoint-interval", required_argument, NULL, 'C'},
+        {"resume", no_argument, NULL, 'R'},
+        {"compare", no_argument, NULL, 'A'},
+        {"budget", required_argument, NULL, 'b'},
+        {"adaptive-look-ahead", no_argument, NULL, 'L'},
+        {"map", required_argument, NULL, 'M'},
+        {"generate", required_argument, NULL, 'G'},
+        {"corridor-width", required_argument, NULL, 'W'},
+        {"turn-density", required_argument, NULL, 'T'},
+        {"obstacle-fraction", required_argument, NULL, 'X'},
+        {"starts", required_argument, NULL, 'N'},
+        {"goals", required_argument, NULL, 'g'},
+        {"benchmark", required_argument, NULL, 'B'},
+        {"export", required_argument, NULL, 'x'},
+        {NULL, 0, NULL, 0}};
+
+    int option;
+    while ((option = getopt_long(argc, argv, "m:s:l:d:w:S:I:O:ae:t:r:o:c:C:RAb:LM:G:W:T:X:N:g:B:x:", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'm':
+            if (nmodels == MODEL_LIMIT)
+            {
+                fprintf(stderr, "at most %d models are supported\n", MODEL_LIMIT);
+                return 0;
+            }
+            nn_model_filenames[nmodels] = optarg;
+            nmodels++;
+            break;
+        case 's':
+            step_limit = atoi(optarg);
+            break;
+        case 'l':
+            look_ahead_steps = atoi(optarg);
+            break;
+        case 'd':
+            safety_distance = atoi(optarg);
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            break;
+        case 'S':
+            socket_path = optarg;
+            break;
+        case 'I':
+            nn_intra_op_threads = atoi(optarg);
+            break;
+        case 'O':
+            nn_inter_op_threads = atoi(optarg);
+            break;
+        case 'a':
+            abstract = 1;
+            break;
+        case 'e':
+            nepisodes = atol(optarg);
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'r':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            statistics_prefix = optarg;
+            break;
+        case 'c':
+            checkpoint_path = optarg;
+            break;
+        case 'C':
+            checkpoint_interval = atoi(optarg);
+            break;
+        case 'R':
+            resume = 1;
+            break;
+        case 'A':
+            compare = 1;
+            break;
+        case 'b':
+            budget = atol(optarg);
+            break;
+        case 'L':
+            adaptive_look_ahead = 1;
+            break;
+        case 'M':
+            map_filename = optarg;
+            break;
+        case 'G':
+            if (sscanf(optarg, "%dx%d", &generate_width, &generate_height) != 2)
+            {
+                fprintf(stderr, "map size must be given as <width>x<height>\n");
+                return 0;
+            }
+            break;
+        case 'W':
+            corridor_width = atoi(optarg);
+            break;
+        case 'T':
+            turn_density = atof(optarg);
+            break;
+        case 'X':
+            obstacle_fraction = atof(optarg);
+            break;
+        case 'N':
+            nstarts = atoi(optarg);
+            break;
+        case 'g':
+            ngoals = atoi(optarg);
+            break;
+        case 'B':
+            nsizes = atoi(optarg);
+            break;
+        case 'x':
+            dataset_filename = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-m model] [-s steps] [-l look-ahead] [-d safety-distance] "
+                            "[-w workers] [-S socket] [-I intra-op-threads] [-O inter-op-threads] [-a] "
+                            "[-e episodes] [-t threads] [-r seed] [-o output] [-c checkpoint] "
+                            "[-C checkpoint-interval] [-R] [-A] [-b budget] [-L] [-M map] "
+                            "[-G widthxheight [-W corridor-width] [-T turn-density] [-X obstacle-fraction] "
+                            "[-N starts] [-g goals] [-B sizes]] [-x dataset]\n",
+                    argv[0]);
+            return 0;
+        }
+    }
+
+    if (nmodels == 0)
+    {
+        nmodels = 1;
+    }
+    char *nn_model_filename = nn_model_filenames[0];
+
+    if (nsizes > 0)
+    {
+        return run_map_benchmark(generate_width, generate_height, corridor_width, turn_density,
+                                 obstacle_fraction, nstarts, ngoals, seed, nsizes);
+    }
+    if (generate_width > 0)
+    {
+        Map *generated_map = generate_map(generate_width, generate_height, corridor_width, turn_density,
+                                          obstacle_fraction, nstarts, ngoals, seed);
+        if (generated_map == NULL)
+        {
+            return 0;
+        }
+        FILE *file = statistics_prefix != NULL ? fopen(statistics_prefix, "w") : stdout;
+        if (file == NULL)
+        {
+            perror(statistics_prefix);
+            delete_map(generated_map);
+            return 0;
+        }
+        int success = write_map(generated_map, file);
+        if (file != stdout)
+        {
+            success = fclose(file) == 0 && success;
+        }
+        delete_map(generated_map);
+        return success;
+    }
 
-    int success = run_safeguard_controller(map, initial_state, nn_model_filename, step_limit,
-                                           look_ahead_steps, safety_distance);
+    Map *map = map_filename != NULL ? load_map(map_filename) : get_map();
+    if (map == NULL)
+    {
+        return 0;
+    }
+    int success;
+    if (socket_path != NULL)
+    {
+        success = run_controller_service(map, socket_path, nn_model_filenames, nmodels,
+                                         look_ahead_steps, safety_distance);
+    }
+    else if (dataset_filename != NULL)
+    {
+        success = run_dataset_export(map, nn_model_filename, dataset_filename, nthreads, nepisodes, seed,
+                                     step_limit, look_ahead_steps, safety_distance);
+    }
+    else if (compare)
+    {
+        success = run_model_comparison(map, nn_model_filenames, nmodels, statistics_prefix);
+    }
+    else if (abstract)
+    {
+        success = run_abstract_analysis(map, nn_model_filename, look_ahead_steps, safety_distance);
+    }
+    else if (nepisodes > 0)
+    {
+        success = run_parallel_evaluation(map, nn_model_filename, nthreads, nepisodes, seed, step_limit,
+                                          look_ahead_steps, safety_distance, budget * 1000,
+                                          statistics_prefix, checkpoint_path, checkpoint_interval,
+                                          resume);
+    }
+    else if (nworkers > 0)
+    {
+        success = run_sharded_analysis(map, nn_model_filename, nworkers, look_ahead_steps,
+                                       safety_distance, checkpoint_path, checkpoint_interval, resume);
+    }
+    else
+    {
+        State *initial_state = get_intial_state(map);
+        if (budget > 0)
+        {
+            success = run_anytime_safeguard_controller(map, initial_state, nn_model_filename, step_limit,
+                                                       look_ahead_steps, budget * 1000);
+        }
+        else
+        {
+            success = run_safeguard_controller(map, initial_state, nn_model_filename, step_limit,
+                                               look_ahead_steps, safety_distance);
+        }
+        delete_state(initial_state);
+    }
+    delete_map(map);
 
     return success;
 }
@@ -132,79 +835,350 @@ int run_safeguard_controller(const Map *map, const State *initial_state,
     {
         return 0;
     }
-	
-    /* step zero */
-    Acceleration *acceleration = compute_acceleration(map, initial_state, nn_model,
-                                                      look_ahead_steps, safety_distance);
-    State *state = execute_acceleration(map, initial_state, acceleration);
-    delete_acceleration(acceleration);
-    if (state == NULL)
+    NNContext *nn_context = create_nn_context(nn_model);
+    int success = run_safeguard_episode(map, initial_state, nn_context, step_limit, look_ahead_steps,
+                                        safety_distance, 0, NULL, NULL);
+    delete_nn_context(nn_context);
+    delete_nn_model(nn_model);
+    return success == 1;
+}
+
+int run_anytime_safeguard_controller(const Map *map, const State *initial_state,
+                                     const char *nn_model_directory, int step_limit, int look_ahead_steps,
+                                     long budget)
+{
+    if (step_limit < 1)
     {
-        delete_nn_model(nn_model);
         return 0;
     }
 
-    int step = 1;
-    State *next_state;
-    while (!is_goal_state(map, state) && step < step_limit)
+    if (is_goal_state(map, initial_state))
     {
-        acceleration = compute_acceleration(map, state, nn_model, look_ahead_steps, safety_distance);
-        next_state = execute_acceleration(map, state, acceleration);
-        delete_acceleration(acceleration);
-        delete_state(state);
-        state = next_state;
-        if (state == NULL)
-        {
-            delete_nn_model(nn_model);
-            return 0;
-        }
-        step++;
+        return 1;
     }
 
+    NNModel *nn_model = load_nn_model(nn_model_directory);
+    if (nn_model == NULL)
+    {
+        return 0;
+    }
+    NNContext *nn_context = create_nn_context(nn_model);
+    LatencyHistogram *latencies = create_latency_histogram();
+    int success = run_safeguard_episode(map, initial_state, nn_context, step_limit, look_ahead_steps, 0,
+                                        budget, NULL, latencies);
+    print_latencies(latencies);
+    delete_latency_histogram(latencies);
+    delete_nn_context(nn_context);
     delete_nn_model(nn_model);
-    return 1;
+    return success == 1;
 }
 
-Acceleration *compute_acceleration(const Map *map, const State *state, const NNModel *nn_model,
-                                   int look_ahead_steps, int safety_distance)
+int run_safeguard_episode(const Map *map, const State *initial_state, NNContext *nn_context,
+                          int step_limit, int look_ahead_steps, int safety_distance, long budget,
+                          struct EpisodeTrace *trace, LatencyHistogram *latencies)
 {
+    if (step_limit < 1)
+    {
+        return 0;
+    }
 
+    if (is_goal_state(map, initial_state))
+    {
+        record_event(map, trace, initial_state, STATISTICS_GOALS);
+        return 1;
+    }
 
-    NNInput *nn_input = get_nn_input(map, state, nn_model);
-    Acceleration *acceleration = call_nn_model(nn_model, nn_input);
-
-    if (!look_ahead_check(map, state, nn_model, look_ahead_steps, safety_distance))
+    const State *state = initial_state;
+    State *next_state = NULL;
+    int step = 0;
+    do
     {
-        Acceleration *negated_acceleration = get_negated_acceleration(acceleration);
+        record_event(map, trace, state, STATISTICS_VISITS);
+        int fallback;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        Acceleration *acceleration;
+        if (budget > 0)
+        {
+            acceleration = compute_anytime_acceleration(map, state, nn_context, look_ahead_steps, budget,
+                                                        &fallback);
+        }
+        else
+        {
+            acceleration = compute_safeguarded_acceleration(map, state, nn_context, look_ahead_steps,
+                                                            safety_distance, &fallback);
+        }
+        if (latencies != NULL)
+        {
+            record_latency(latencies, get_elapsed_time(&start));
+        }
+        if (acceleration == NULL)
+        {
+            if (state != initial_state)
+            {
+                delete_state((State *)state);
+            }
+            return EPISODE_ERROR;
+        }
+        if (fallback)
+        {
+            record_event(map, trace, state, STATISTICS_FALLBACKS);
+        }
+        next_state = execute_acceleration(map, state, acceleration);
         delete_acceleration(acceleration);
-        acceleration = negated_acceleration;
+        if (next_state == NULL)
+        {
+            record_event(map, trace, state, STATISTICS_CRASHES);
+        }
+        if (state != initial_state)
+        {
+            delete_state((State *)state);
+        }
+        if (next_state == NULL)
+        {
+            return 0;
+        }
+        state = next_state;
+        step++;
+    } while (!is_goal_state(map, state) && step < step_limit);
+
+    if (is_goal_state(map, state))
+    {
+        record_event(map, trace, state, STATISTICS_GOALS);
     }
-    return acceleration;
+    delete_state(next_state);
+    return 1;
 }
 
-int look_ahead_check(const Map *map, const State *state, const NNModel *nn_model,
-                     int look_ahead_steps, int safety_distance)
+Acceleration *compute_anytime_acceleration(const Map *map, const State *state, NNContext *nn_context,
+                                           int look_ahead_steps, long budget, int *fallback)
 {
-
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int action = get_nn_context_action(nn_context, map, state);
+    if (action < 0)
+    {
+        return NULL;
+    }
+    *fallback = 0;
     if (look_ahead_steps < 1)
     {
-        return 1;
+        return create_acceleration(action / 3 - 1, action % 3 - 1);
     }
 
-    NNInput *nn_input = get_nn_input(map, state, nn_model);
-    Acceleration *simulated_acceleration = call_nn_model(nn_model, nn_input);
-    ;
-    State *simulated_state = simulate_acceleration(map, state, simulated_acceleration);
-    delete_nn_input(nn_input);
-    delete_acceleration(simulated_acceleration);
-    if (simulated_state == NULL)
+    /* the action of the network is checked first, then its negation as in the fixed safeguard and
+       then the remaining actions, each by the look ahead of look_ahead_check while the budget
+       allows another step as long as the previous one. The first action that passes, or that is
+       not refuted when the budget runs out, is taken, and if every action crashes, the one that
+       crashes last. */
+    int candidates[OUTPUT_SIZE];
+    int ncandidates = 0;
+    candidates[ncandidates++] = action;
+    if (OUTPUT_SIZE - 1 - action != action)
     {
-        return 0;
+        candidates[ncandidates++] = OUTPUT_SIZE - 1 - action;
+    }
+    for (int i = 0; i < OUTPUT_SIZE; i++)
+    {
+        if (i != action && i != OUTPUT_SIZE - 1 - action)
+        {
+            candidates[ncandidates++] = i;
+        }
     }
-    int safe = look_ahead_check(map, simulated_state, nn_model, look_ahead_steps - 1, safety_distance);
-    delete_state(simulated_state);
-    return safe;
-}
+
+    long step_time = get_elapsed_time(&start);
+    int best_action = action;
+    int best_depth = -1;
+    for (int i = 0; i < ncandidates; i++)
+    {
+        int crashed;
+        int depth = check_anytime_action(map, state, nn_context, candidates[i], look_ahead_steps, budget,
+                                         &start, &step_time, &crashed);
+        if (depth < 0)
+        {
+            return NULL;
+        }
+        if (!crashed)
+        {
+            best_action = candidates[i];
+            break;
+        }
+        if (depth > best_depth)
+        {
+            best_action = candidates[i];
+            best_depth = depth;
+        }
+    }
+    *fallback = best_action != action;
+    return create_acceleration(best_action / 3 - 1, best_action % 3 - 1);
+}
+
+int check_anytime_action(const Map *map, const State *state, NNContext *nn_context, int action,
+                         int look_ahead_steps, long budget, const struct timespec *start, long *step_time,
+                         int *crashed)
+{
+    /* the simulated states are kept on the stack, the first step applies the given action and
+       needs no inference */
+    Position position = *state->position;
+    Velocity velocity = *state->velocity;
+    State simulated_state = {&position, &velocity};
+    Acceleration acceleration = {action / 3 - 1, action % 3 - 1};
+    int depth = 0;
+    *crashed = 0;
+    while (1)
+    {
+        if (!is_valid_acceleration(map, &simulated_state, &acceleration))
+        {
+            *crashed = 1;
+            return depth;
+        }
+        velocity.x += acceleration.x;
+        velocity.y += acceleration.y;
+        position.x += velocity.x;
+        position.y += velocity.y;
+        depth++;
+        if (depth >= look_ahead_steps || is_goal_state(map, &simulated_state))
+        {
+            return depth;
+        }
+        long elapsed = get_elapsed_time(start);
+        if (elapsed + *step_time > budget)
+        {
+            return depth;
+        }
+        int simulated_action = get_nn_context_action(nn_context, map, &simulated_state);
+        if (simulated_action < 0)
+        {
+            return -1;
+        }
+        *step_time = get_elapsed_time(start) - elapsed;
+        acceleration.x = simulated_action / 3 - 1;
+        acceleration.y = simulated_action % 3 - 1;
+    }
+}
+
+Acceleration *compute_acceleration(const Map *map, const State *state, NNContext *nn_context,
+                                   int look_ahead_steps, int safety_distance)
+{
+    return compute_safeguarded_acceleration(map, state, nn_context, look_ahead_steps, safety_distance,
+                                            NULL);
+}
+
+Acceleration *compute_safeguarded_acceleration(const Map *map, const State *state, NNContext *nn_context,
+                                               int look_ahead_steps, int safety_distance, int *fallback)
+{
+    Acceleration *acceleration = call_nn_context(nn_context, map, state);
+    if (acceleration == NULL)
+    {
+        return NULL;
+    }
+
+    int safe = look_ahead_check(map, state, nn_context, look_ahead_steps, safety_distance);
+    if (fallback != NULL)
+    {
+        *fallback = !safe;
+    }
+    if (!safe)
+    {
+        Acceleration *negated_acceleration = get_negated_acceleration(acceleration);
+        delete_acceleration(acceleration);
+        acceleration = negated_acceleration;
+    }
+    return acceleration;
+}
+
+int look_ahead_check(const Map *map, const State *state, NNContext *nn_context,
+                     int look_ahead_steps, int safety_distance)
+{
+
+    if (look_ahead_steps < 1)
+    {
+        return 1;
+    }
+
+    if (adaptive_look_ahead && is_look_ahead_safe(map, state, look_ahead_steps))
+    {
+        return 1;
+    }
+
+    /* the simulated state of get_next_state, kept on the stack */
+    int action = get_nn_context_action(nn_context, map, state);
+    if (action < 0)
+    {
+        return 0;
+    }
+    Acceleration simulated_acceleration = {action / 3 - 1, action % 3 - 1};
+    if (!is_valid_acceleration(map, state, &simulated_acceleration))
+    {
+        return 0;
+    }
+    Velocity velocity = {state->velocity->x + simulated_acceleration.x, state->velocity->y + simulated_acceleration.y};
+    Position position = {state->position->x + velocity.x, state->position->y + velocity.y};
+    State simulated_state = {&position, &velocity};
+    return look_ahead_check(map, &simulated_state, nn_context, look_ahead_steps - 1, safety_distance);
+}
+
+int is_look_ahead_safe(const Map *map, const State *state, int look_ahead_steps)
+{
+    /* the look ahead passes whatever the network chooses if every sequence of accelerations keeps
+       the velocity within the limits and the vehicle within a wall free rectangle */
+    Position *position = state->position;
+    Velocity *velocity = state->velocity;
+    if (abs(velocity->x) + look_ahead_steps > velocity_limit_x ||
+        abs(velocity->y) + look_ahead_steps > velocity_limit_y)
+    {
+        return 0;
+    }
+
+    int x_lower, x_upper, y_lower, y_upper;
+    get_displacement_bounds(velocity->x, look_ahead_steps, &x_lower, &x_upper);
+    get_displacement_bounds(velocity->y, look_ahead_steps, &y_lower, &y_upper);
+    return is_wall_free(map, position->x + x_lower, position->y + y_lower, position->x + x_upper,
+                        position->y + y_upper);
+}
+
+void get_displacement_bounds(int velocity, int look_ahead_steps, int *lower, int *upper)
+{
+    /* after k steps the displacement lies within k * velocity -+ k * (k + 1) / 2, and the positions
+       traversed by a step lie between the positions before and after it */
+    *lower = 0;
+    *upper = 0;
+    for (int k = 1; k <= look_ahead_steps; k++)
+    {
+        int spread = k * (k + 1) / 2;
+        *lower = k * velocity - spread < *lower ? k * velocity - spread : *lower;
+        *upper = k * velocity + spread > *upper ? k * velocity + spread : *upper;
+    }
+}
+
+int is_wall_free(const Map *map, int x_lower, int y_lower, int x_upper, int y_upper)
+{
+    if (x_lower < 0 || y_lower < 0 || x_upper >= map->width || y_upper >= map->height)
+    {
+        return 0;
+    }
+    int stride = map->height + 1;
+    const int *wall_counts = map->wall_counts;
+    int walls = wall_counts[(x_upper + 1) * stride + y_upper + 1] - wall_counts[x_lower * stride + y_upper + 1] -
+                wall_counts[(x_upper + 1) * stride + y_lower] + wall_counts[x_lower * stride + y_lower];
+    return walls == 0;
+}
+
+void set_wall_counts(Map *map)
+{
+    int stride = map->height + 1;
+    map->wall_counts = calloc((map->width + 1) * stride, sizeof(int));
+    for (int x = 0; x < map->width; x++)
+    {
+        for (int y = 0; y < map->height; y++)
+        {
+            map->wall_counts[(x + 1) * stride + y + 1] = (map->grid[x][y] == 'x') +
+                                                         map->wall_counts[x * stride + y + 1] +
+                                                         map->wall_counts[(x + 1) * stride + y] -
+                                                         map->wall_counts[x * stride + y];
+        }
+    }
+}
 
 State *simulate_acceleration(const Map *map, const State *state, const Acceleration *acceleration)
 {
@@ -257,6 +1231,12 @@ int is_goal_state(const Map *map, const State *state)
 Distance *get_goal_distance(const Map *map, const Position *position)
 {
     Distance *goal_distance = malloc(sizeof(Distance));
+    fill_goal_distance(map, position, goal_distance);
+    return goal_distance;
+}
+
+void fill_goal_distance(const Map *map, const Position *position, Distance *goal_distance)
+{
     goal_distance->x = map->width;
     goal_distance->y = map->height;
     goal_distance->l1 = map->width + map->height;
@@ -275,7 +1255,6 @@ Distance *get_goal_distance(const Map *map, const Position *position)
             goal_distance->l1 = l1;
         }
     }
-    return goal_distance;
 }
 
 Acceleration *get_negated_acceleration(const Acceleration *acceleration)
@@ -332,7 +1311,7 @@ int is_valid_velocity(const Map *map, const Position *position, const Velocity *
     int vx = velocity->x;
     int vy = velocity->y;
 
-    if (vx > velocity_limit_x || vy > velocity_limit_y)
+    if (abs(vx) > velocity_limit_x || abs(vy) > velocity_limit_y)
     {
         return 0;
     }
@@ -416,6 +1395,10 @@ Velocity *get_start_velocity()
 
 void delete_map(Map *map)
 {
+    for (int x = 0; x < map->width; x++)
+    {
+        free(map->grid[x]);
+    }
     free(map->grid);
     for (int i = 0; i < map->nstarts; i++)
     {
@@ -427,6 +1410,7 @@ void delete_map(Map *map)
     }
     free(map->starts);
     free(map->goals);
+    free(map->wall_counts);
     free(map);
 }
 
@@ -461,25 +1445,48 @@ Map *get_map()
 {
     int width = sizeof(MAP) / sizeof(MAP[0]);
     int height = sizeof(MAP[0]) / sizeof(MAP[0][0]);
+    Map *map = create_map(width, height);
+    for (int x = 0; x < width; x++)
+    {
+        memcpy(map->grid[x], MAP[x], height);
+    }
+    index_map(map);
+    return map;
+}
+
+Map *create_map(int width, int height)
+{
     Map *map = malloc(sizeof(Map));
     map->width = width;
     map->height = height;
     map->nstarts = 0;
     map->ngoals = 0;
-    int starts_size = 1;
-    int goals_size = 1;
-    map->starts = malloc(starts_size * sizeof(Position *));
-    map->goals = malloc(goals_size * sizeof(Position *));
+    map->starts = NULL;
+    map->goals = NULL;
+    map->wall_counts = NULL;
     char **grid = (char **)malloc(width * sizeof(char *));
     for (int x = 0; x < width; x++)
     {
         grid[x] = (char *)malloc(height * sizeof(char));
+        memset(grid[x], 'x', height);
     }
+    map->grid = grid;
+    return map;
+}
+
+void index_map(Map *map)
+{
+    int width = map->width;
+    int height = map->height;
+    char **grid = map->grid;
+    int starts_size = 1;
+    int goals_size = 1;
+    map->starts = malloc(starts_size * sizeof(Position *));
+    map->goals = malloc(goals_size * sizeof(Position *));
     for (int y = 0; y < height; y++)
     {
         for (int x = 0; x < width; x++)
         {
-            grid[x][y] = MAP[x][y];
             if (grid[x][y] == 's')
             {
                 if (map->nstarts == starts_size)
@@ -508,13 +1515,77 @@ Map *get_map()
             }
         }
     }
-    map->grid = grid;
+    set_wall_counts(map);
+}
+
+Map *read_map(FILE *file)
+{
+    int width, height;
+    if (fscanf(file, " dim: %d %d", &width, &height) != 2 || width < 1 || height < 1)
+    {
+        fprintf(stderr, "missing dim header\n");
+        return NULL;
+    }
+    Map *map = create_map(width, height);
+    /* room for the cells, the line break and the terminating zero */
+    char *line = malloc(height + 3);
+    fgets(line, height + 3, file);
+    for (int x = 0; x < width; x++)
+    {
+        if (fgets(line, height + 3, file) == NULL || strcspn(line, "\r\n") != (size_t)height ||
+            strspn(line, "x.sg") != (size_t)height)
+        {
+            fprintf(stderr, "malformed row %d\n", x);
+            free(line);
+            delete_map(map);
+            return NULL;
+        }
+        memcpy(map->grid[x], line, height);
+    }
+    free(line);
+    index_map(map);
+    if (map->nstarts == 0 || map->ngoals == 0)
+    {
+        fprintf(stderr, "map without start or goal positions\n");
+        delete_map(map);
+        return NULL;
+    }
+    return map;
+}
+
+Map *load_map(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        perror(filename);
+        return NULL;
+    }
+    Map *map = read_map(file);
+    fclose(file);
     return map;
 }
 
+int write_map(const Map *map, FILE *file)
+{
+    fprintf(file, "dim: %d %d\n", map->width, map->height);
+    for (int x = 0; x < map->width; x++)
+    {
+        fwrite(map->grid[x], 1, map->height, file);
+        fputc('\n', file);
+    }
+    return !ferror(file);
+}
+
 float *get_feature_values(const Map *map, const State *state)
 {
-    float *feature_values = malloc(14 * sizeof(int));
+    float *feature_values = malloc(INPUT_SIZE * sizeof(float));
+    fill_feature_values(map, state, feature_values);
+    return feature_values;
+}
+
+void fill_feature_values(const Map *map, const State *state, float *feature_values)
+{
     Position *position = get_position(state);
     feature_values[0] = (float)position->x;
     feature_values[1] = (float)position->y;
@@ -535,14 +1606,19 @@ float *get_feature_values(const Map *map, const State *state)
             i++;
         }
     }
-    Distance *goal_distance = get_goal_distance(map, position);
-    feature_values[12] = (float)goal_distance->x;
-    feature_values[13] = (float)goal_distance->y;
-    return feature_values;
+    Distance goal_distance;
+    fill_goal_distance(map, position, &goal_distance);
+    feature_values[12] = (float)goal_distance.x;
+    feature_values[13] = (float)goal_distance.y;
 }
 
 
 NNModel *load_nn_model(const char *filename)
+{
+    return load_nn_model_with_threads(filename, nn_intra_op_threads, nn_inter_op_threads);
+}
+
+NNModel *load_nn_model_with_threads(const char *filename, int intra_op_threads, int inter_op_threads)
 {
 
     /* computation graph */
@@ -551,31 +1627,85 @@ NNModel *load_nn_model(const char *filename)
     TF_Status *status = TF_NewStatus();
     /* options that can be passed at session creation */
     TF_SessionOptions *session_opts = TF_NewSessionOptions();
+    if (intra_op_threads > 0 || inter_op_threads > 0)
+    {
+        /* serialized ConfigProto with intra_op_parallelism_threads (field 2) and
+           inter_op_parallelism_threads (field 5) as varints */
+        unsigned char config[12];
+        size_t config_len = 0;
+        int fields[2] = {2, 5};
+        int values[2] = {intra_op_threads, inter_op_threads};
+        for (int i = 0; i < 2; i++)
+        {
+            if (values[i] <= 0)
+            {
+                continue;
+            }
+            config[config_len++] = fields[i] << 3;
+            unsigned int value = values[i];
+            while (value >= 0x80)
+            {
+                config[config_len++] = (value & 0x7f) | 0x80;
+                value >>= 7;
+            }
+            config[config_len++] = value;
+        }
+        TF_SetConfig(session_opts, config, config_len, status);
+        if (TF_GetCode(status) != TF_OK)
+        {
+            fprintf(stderr, "failed to configure threads: %s\n", TF_Message(status));
+            TF_DeleteSessionOptions(session_opts);
+            TF_DeleteGraph(graph);
+            TF_DeleteStatus(status);
+            return NULL;
+        }
+    }
     TF_Buffer *run_opts = NULL;
     const char *tags = "serve";
     int tags_len = 1;
 
     TF_Session *session = TF_LoadSessionFromSavedModel(session_opts, run_opts, filename,
                                                        &tags, tags_len, graph, NULL, status);
+    TF_DeleteSessionOptions(session_opts);
+    if (TF_GetCode(status) != TF_OK)
+    {
+        fprintf(stderr, "failed to load %s: %s\n", filename, TF_Message(status));
+        TF_DeleteGraph(graph);
+        TF_DeleteStatus(status);
+        return NULL;
+    }
+
+    TF_Operation *input_operation = TF_GraphOperationByName(graph, "main/input");
+    TF_Operation *output_operation = TF_GraphOperationByName(graph, "main/output/BiasAdd");
+    if (input_operation == NULL || output_operation == NULL)
+    {
+        fprintf(stderr, "missing input or output operation in %s\n", filename);
+        TF_DeleteSession(session, status);
+        TF_DeleteGraph(graph);
+        TF_DeleteStatus(status);
+        return NULL;
+    }
 
     NNModel *nn_model = malloc(sizeof(NNModel));
     nn_model->graph = graph;
     nn_model->session = session;
     nn_model->status = status;
+    nn_model->input.oper = input_operation;
+    nn_model->input.index = 0;
+    nn_model->output.oper = output_operation;
+    nn_model->output.index = 0;
     return nn_model;
 }
 
-/* TODO free memory */
 NNInput *get_nn_input(const Map *map, const State *state, const NNModel *nn_model)
 {
     const int64_t dims[2] = {1, INPUT_SIZE};
     const size_t ndata = INPUT_SIZE * sizeof(float);
     float *feature_values = get_feature_values(map, state);
 
-    
-
     TF_Tensor *tensor = TF_AllocateTensor(TF_FLOAT, dims, 2, ndata);
     memcpy(TF_TensorData(tensor), feature_values, ndata);
+    free(feature_values);
     TF_Tensor **input_values = malloc(sizeof(TF_Tensor *));
     input_values[0] = tensor;
 
@@ -584,25 +1714,35 @@ NNInput *get_nn_input(const Map *map, const State *state, const NNModel *nn_mode
     return nn_input;
 }
 
-/* TODO free memory */
 Acceleration *call_nn_model(const NNModel *nn_model, const NNInput *nn_input)
 {
 
-    TF_Operation *input_operation = TF_GraphOperationByName(nn_model->graph, "main/input");
-    TF_Output input[1] = {input_operation, 0};
-
-    TF_Operation *output_operation = TF_GraphOperationByName(nn_model->graph, "main/output/BiasAdd");
-    TF_Output output[1] = {output_operation, 0};
+    TF_Output input[1] = {nn_model->input};
+    TF_Output output[1] = {nn_model->output};
 
     TF_Tensor **input_values = nn_input->values;
 
     TF_Tensor *output_values[1] = {NULL};
 
     TF_SessionRun(nn_model->session, NULL, input, input_values, 1, output, output_values, 1, NULL, 0, NULL, nn_model->status);
+    if (TF_GetCode(nn_model->status) != TF_OK)
+    {
+        fprintf(stderr, "failed to run the model: %s\n", TF_Message(nn_model->status));
+        return NULL;
+    }
 
-    float *q_values = (float *)malloc(OUTPUT_SIZE * sizeof(float));
+    float q_values[OUTPUT_SIZE];
     memcpy(q_values, TF_TensorData(output_values[0]), OUTPUT_SIZE * sizeof(float));
+    TF_DeleteTensor(output_values[0]);
+
+    int max_q_value_index = get_max_q_value_index(q_values);
+    int ax = (max_q_value_index / 3) - 1;
+    int ay = (max_q_value_index % 3) - 1;
+    return create_acceleration(ax, ay);
+}
 
+int get_max_q_value_index(const float *q_values)
+{
     int max_q_value_index = 0;
     float max_q_value = q_values[max_q_value_index];
     for (int i = 0; i < OUTPUT_SIZE; i++)
@@ -613,11 +1753,66 @@ Acceleration *call_nn_model(const NNModel *nn_model, const NNInput *nn_input)
             max_q_value_index = i;
         }
     }
+    return max_q_value_index;
+}
+
+NNContext *create_nn_context(const NNModel *nn_model)
+{
+    const int64_t dims[2] = {1, INPUT_SIZE};
+    NNContext *nn_context = malloc(sizeof(NNContext));
+    if (nn_context == NULL)
+    {
+        return NULL;
+    }
+    nn_context->nn_model = nn_model;
+    nn_context->input_values[0] = TF_AllocateTensor(TF_FLOAT, dims, 2, INPUT_SIZE * sizeof(float));
+    if (nn_context->input_values[0] == NULL)
+    {
+        free(nn_context);
+        return NULL;
+    }
+    nn_context->status = TF_NewStatus();
+    return nn_context;
+}
+
+Acceleration *call_nn_context(NNContext *nn_context, const Map *map, const State *state)
+{
+    int max_q_value_index = get_nn_context_action(nn_context, map, state);
+    if (max_q_value_index < 0)
+    {
+        return NULL;
+    }
     int ax = (max_q_value_index / 3) - 1;
     int ay = (max_q_value_index % 3) - 1;
     return create_acceleration(ax, ay);
 }
 
+int get_nn_context_action(NNContext *nn_context, const Map *map, const State *state)
+{
+    const NNModel *nn_model = nn_context->nn_model;
+    fill_feature_values(map, state, TF_TensorData(nn_context->input_values[0]));
+
+    /* the C API always allocates the output tensor, only the input can be reused */
+    TF_Tensor *output_values[1] = {NULL};
+    TF_SessionRun(nn_model->session, NULL, &nn_model->input, nn_context->input_values, 1,
+                  &nn_model->output, output_values, 1, NULL, 0, NULL, nn_context->status);
+    if (TF_GetCode(nn_context->status) != TF_OK)
+    {
+        fprintf(stderr, "failed to run the model: %s\n", TF_Message(nn_context->status));
+        return -1;
+    }
+    memcpy(nn_context->q_values, TF_TensorData(output_values[0]), OUTPUT_SIZE * sizeof(float));
+    TF_DeleteTensor(output_values[0]);
+    return get_max_q_value_index(nn_context->q_values);
+}
+
+void delete_nn_context(NNContext *nn_context)
+{
+    TF_DeleteTensor(nn_context->input_values[0]);
+    TF_DeleteStatus(nn_context->status);
+    free(nn_context);
+}
+
 void delete_nn_model(NNModel *nn_model)
 {
     TF_DeleteGraph(nn_model->graph);
@@ -626,7 +1821,2739 @@ void delete_nn_model(NNModel *nn_model)
     free(nn_model);
 }
 
-/* TODO implement this function */
 void delete_nn_input(NNInput *nn_input)
 {
+    TF_DeleteTensor(nn_input->values[0]);
+    free(nn_input->values);
+    free(nn_input);
+}
+
+int get_state_count(const Map *map)
+{
+    int velocities_x = 2 * velocity_limit_x + 1;
+    int velocities_y = 2 * velocity_limit_y + 1;
+    return map->width * map->height * velocities_x * velocities_y;
+}
+
+int get_state_index(const Map *map, const State *state)
+{
+    Position *position = state->position;
+    Velocity *velocity = state->velocity;
+    int velocities_x = 2 * velocity_limit_x + 1;
+    int velocities_y = 2 * velocity_limit_y + 1;
+    int position_index = position->x * map->height + position->y;
+    int velocity_index = (velocity->x + velocity_limit_x) * velocities_y + velocity->y + velocity_limit_y;
+    return position_index * velocities_x * velocities_y + velocity_index;
+}
+
+void get_indexed_state(const Map *map, int state_index, Position *position, Velocity *velocity)
+{
+    int velocities_x = 2 * velocity_limit_x + 1;
+    int velocities_y = 2 * velocity_limit_y + 1;
+    int velocity_index = state_index % (velocities_x * velocities_y);
+    int position_index = state_index / (velocities_x * velocities_y);
+    position->x = position_index / map->height;
+    position->y = position_index % map->height;
+    velocity->x = velocity_index / velocities_y - velocity_limit_x;
+    velocity->y = velocity_index % velocities_y - velocity_limit_y;
+}
+
+int get_shard(const Map *map, const Position *position, int nworkers)
+{
+    int tiles_y = (map->height + TILE_SIZE - 1) / TILE_SIZE;
+    int tile = (position->x / TILE_SIZE) * tiles_y + position->y / TILE_SIZE;
+    return tile % nworkers;
+}
+
+int ring_push(struct Ring *ring, int state_index)
+{
+    size_t position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    struct RingSlot *slot;
+    for (;;)
+    {
+        slot = &ring->slots[position & (RING_CAPACITY - 1)];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        long difference = (long)sequence - (long)position;
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            /* full */
+            return 0;
+        }
+        else
+        {
+            position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+    slot->state_index = state_index;
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+    return 1;
+}
+
+int ring_pop(struct Ring *ring, int *state_index)
+{
+    /* only the owning worker pops, so the head is never contended */
+    size_t position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct RingSlot *slot = &ring->slots[position & (RING_CAPACITY - 1)];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (sequence != position + 1)
+    {
+        return 0;
+    }
+    *state_index = slot->state_index;
+    atomic_store_explicit(&slot->sequence, position + RING_CAPACITY, memory_order_release);
+    atomic_store_explicit(&ring->head, position + 1, memory_order_relaxed);
+    return 1;
+}
+
+void claim_state(const Map *map, struct SharedAnalysis *analysis, const State *state,
+                 int **overflow, int *noverflow, int *overflow_size)
+{
+    int state_index = get_state_index(map, state);
+    int bits = 8 * sizeof(unsigned long);
+    unsigned long mask = 1UL << (state_index % bits);
+    if (atomic_fetch_or(&analysis->visited[state_index / bits], mask) & mask)
+    {
+        return;
+    }
+    enqueue_state(map, analysis, state_index, state->position, overflow, noverflow, overflow_size);
+}
+
+void enqueue_state(const Map *map, struct SharedAnalysis *analysis, int state_index, const Position *position,
+                   int **overflow, int *noverflow, int *overflow_size)
+{
+    atomic_fetch_add(&analysis->pending, 1);
+    int shard = get_shard(map, position, analysis->nworkers);
+    if (ring_push(&analysis->rings[shard], state_index))
+    {
+        return;
+    }
+    /* the owner is saturated, keep the state and process it locally */
+    if (*noverflow == *overflow_size)
+    {
+        *overflow_size = *overflow_size > 0 ? 2 * *overflow_size : 64;
+        *overflow = realloc(*overflow, *overflow_size * sizeof(int));
+    }
+    (*overflow)[*noverflow] = state_index;
+    *noverflow += 1;
+}
+
+int run_analysis_worker(const Map *map, struct SharedAnalysis *analysis, int worker,
+                        const char *nn_model_directory, int look_ahead_steps, int safety_distance,
+                        const int *seeds, int nseeds)
+{
+    NNModel *nn_model = load_nn_model(nn_model_directory);
+    if (nn_model == NULL)
+    {
+        atomic_store(&analysis->failed, 1);
+        return 0;
+    }
+    NNContext *nn_context = create_nn_context(nn_model);
+
+    /* the states that the coordinator could not push into the rings are shared out evenly, any
+       worker may process any state */
+    int *overflow = NULL;
+    int noverflow = 0;
+    int overflow_size = 0;
+    for (int i = worker; i < nseeds; i += analysis->nworkers)
+    {
+        if (noverflow == overflow_size)
+        {
+            overflow_size = overflow_size > 0 ? 2 * overflow_size : 64;
+            overflow = realloc(overflow, overflow_size * sizeof(int));
+        }
+        overflow[noverflow] = seeds[i];
+        noverflow++;
+    }
+    int state_index;
+    for (;;)
+    {
+        if (noverflow > 0)
+        {
+            noverflow -= 1;
+            state_index = overflow[noverflow];
+        }
+        else if (!ring_pop(&analysis->rings[worker], &state_index))
+        {
+            if (atomic_load(&analysis->pending) == 0 || atomic_load(&analysis->failed))
+            {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+
+        Position position;
+        Velocity velocity;
+        get_indexed_state(map, state_index, &position, &velocity);
+        State state = {&position, &velocity};
+
+        if (is_goal_state(map, &state))
+        {
+            atomic_store_explicit(&analysis->verdicts[state_index], VERDICT_GOAL, memory_order_release);
+        }
+        else
+        {
+            Acceleration *acceleration = compute_acceleration(map, &state, nn_context,
+                                                              look_ahead_steps, safety_distance);
+            if (acceleration == NULL)
+            {
+                atomic_store(&analysis->failed, 1);
+                break;
+            }
+            State *next_state = get_next_state(map, &state, acceleration);
+            delete_acceleration(acceleration);
+            if (next_state == NULL)
+            {
+                atomic_store_explicit(&analysis->verdicts[state_index], VERDICT_CRASH, memory_order_release);
+            }
+            else
+            {
+                /* claimed first, so a checkpoint that sees the verdict also sees the successor */
+                claim_state(map, analysis, next_state, &overflow, &noverflow, &overflow_size);
+                atomic_store_explicit(&analysis->verdicts[state_index], VERDICT_SAFE, memory_order_release);
+                delete_state(next_state);
+            }
+        }
+        atomic_fetch_sub(&analysis->pending, 1);
+    }
+
+    free(overflow);
+    delete_nn_context(nn_context);
+    delete_nn_model(nn_model);
+    return 1;
+}
+
+int run_sharded_analysis(const Map *map, const char *nn_model_directory, int nworkers,
+                         int look_ahead_steps, int safety_distance, const char *checkpoint_path,
+                         int checkpoint_interval, int resume)
+{
+    if (nworkers < 1 || (resume && checkpoint_path == NULL))
+    {
+        return 0;
+    }
+
+    /* the coordinator never loads a model, every worker owns its own session */
+    int nstates = get_state_count(map);
+    int bits = 8 * sizeof(unsigned long);
+    size_t nwords = (nstates + bits - 1) / bits;
+    size_t header_size = sizeof(struct SharedAnalysis);
+    size_t rings_size = nworkers * sizeof(struct Ring);
+    size_t visited_size = nwords * sizeof(atomic_ulong);
+    size_t shared_size = header_size + rings_size + visited_size + nstates * sizeof(atomic_uchar);
+    char *shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    /* anonymous mappings are zero filled, so only the ring sequences need initialization */
+    struct SharedAnalysis *analysis = (struct SharedAnalysis *)shared;
+    analysis->nworkers = nworkers;
+    analysis->nstates = nstates;
+    analysis->rings = (struct Ring *)(shared + header_size);
+    analysis->visited = (atomic_ulong *)(shared + header_size + rings_size);
+    analysis->verdicts = (atomic_uchar *)(shared + header_size + rings_size + visited_size);
+    atomic_init(&analysis->pending, 0);
+    atomic_init(&analysis->failed, 0);
+    for (int worker = 0; worker < nworkers; worker++)
+    {
+        struct Ring *ring = &analysis->rings[worker];
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        for (size_t i = 0; i < RING_CAPACITY; i++)
+        {
+            atomic_init(&ring->slots[i].sequence, i);
+        }
+    }
+
+    struct AnalysisCheckpoint checkpoint;
+    checkpoint.map = map;
+    checkpoint.analysis = analysis;
+    checkpoint.path = checkpoint_path;
+    checkpoint.interval = checkpoint_interval > 0 ? checkpoint_interval : 1;
+    checkpoint.look_ahead_steps = look_ahead_steps;
+    checkpoint.safety_distance = safety_distance;
+    checkpoint.model_hash = get_model_hash(nn_model_directory);
+    pthread_mutex_init(&checkpoint.mutex, NULL);
+    pthread_cond_init(&checkpoint.condition, NULL);
+    checkpoint.done = 0;
+
+    /* the work queues of a resumed analysis are the visited states without a verdict */
+    int *overflow = NULL;
+    int noverflow = 0;
+    int overflow_size = 0;
+    if (resume)
+    {
+        if (!read_analysis_checkpoint(&checkpoint))
+        {
+            pthread_cond_destroy(&checkpoint.condition);
+            pthread_mutex_destroy(&checkpoint.mutex);
+            munmap(shared, shared_size);
+            return 0;
+        }
+        for (int state_index = 0; state_index < nstates; state_index++)
+        {
+            if ((atomic_load(&analysis->visited[state_index / bits]) & (1UL << (state_index % bits))) &&
+                atomic_load(&analysis->verdicts[state_index]) == VERDICT_UNKNOWN)
+            {
+                Position position;
+                Velocity velocity;
+                get_indexed_state(map, state_index, &position, &velocity);
+                enqueue_state(map, analysis, state_index, &position, &overflow, &noverflow, &overflow_size);
+            }
+        }
+    }
+    else
+    {
+        for (int i = 0; i < map->nstarts; i++)
+        {
+            Velocity start_velocity = {0, 0};
+            State start_state = {map->starts[i], &start_velocity};
+            claim_state(map, analysis, &start_state, &overflow, &noverflow, &overflow_size);
+        }
+    }
+
+    fflush(stdout);
+    pid_t *workers = malloc(nworkers * sizeof(pid_t));
+    int success = 1;
+    for (int worker = 0; worker < nworkers; worker++)
+    {
+        workers[worker] = fork();
+        if (workers[worker] == 0)
+        {
+            int ok = run_analysis_worker(map, analysis, worker, nn_model_directory,
+                                         look_ahead_steps, safety_distance, overflow, noverflow);
+            _exit(ok ? 0 : 1);
+        }
+        if (workers[worker] < 0)
+        {
+            atomic_store(&analysis->failed, 1);
+            nworkers = worker;
+            break;
+        }
+    }
+    free(overflow);
+
+    /* the thread is started after the workers are forked, so they never inherit it */
+    pthread_t checkpoint_thread;
+    int checkpointing = checkpoint_path != NULL &&
+                        pthread_create(&checkpoint_thread, NULL, run_analysis_checkpoint_thread, &checkpoint) == 0;
+    for (int worker = 0; worker < nworkers; worker++)
+    {
+        int status;
+        if (waitpid(workers[worker], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            success = 0;
+        }
+    }
+    free(workers);
+    if (checkpointing)
+    {
+        pthread_mutex_lock(&checkpoint.mutex);
+        checkpoint.done = 1;
+        pthread_cond_signal(&checkpoint.condition);
+        pthread_mutex_unlock(&checkpoint.mutex);
+        pthread_join(checkpoint_thread, NULL);
+    }
+    if (checkpoint_path != NULL)
+    {
+        /* after a failure, the final checkpoint holds the work that is left */
+        success = write_analysis_checkpoint(&checkpoint) && success;
+    }
+    pthread_cond_destroy(&checkpoint.condition);
+    pthread_mutex_destroy(&checkpoint.mutex);
+
+    /* merge the verdicts of all shards */
+    int nvisited = 0;
+    int ncrashes = 0;
+    int ngoals = 0;
+    for (int state_index = 0; state_index < nstates; state_index++)
+    {
+        unsigned char verdict = atomic_load(&analysis->verdicts[state_index]);
+        if (verdict != VERDICT_UNKNOWN)
+        {
+            nvisited++;
+        }
+        if (verdict == VERDICT_CRASH)
+        {
+            ncrashes++;
+        }
+        if (verdict == VERDICT_GOAL)
+        {
+            ngoals++;
+        }
+    }
+    if (atomic_load(&analysis->failed) || atomic_load(&analysis->pending) != 0)
+    {
+        success = 0;
+    }
+    printf("states: %d visited: %d crashes: %d goals: %d\n", nstates, nvisited, ncrashes, ngoals);
+
+    munmap(shared, shared_size);
+    return success && ncrashes == 0;
+}
+
+int write_analysis_checkpoint(struct AnalysisCheckpoint *checkpoint)
+{
+    const Map *map = checkpoint->map;
+    struct SharedAnalysis *analysis = checkpoint->analysis;
+    int bits = 8 * sizeof(unsigned long);
+    size_t nwords = (analysis->nstates + bits - 1) / bits;
+    unsigned char *verdicts = malloc(analysis->nstates);
+    unsigned long *visited = malloc(nwords * sizeof(unsigned long));
+
+    /* the workers are never stopped. The verdicts are copied before the visited states, so the
+       successor of every state with a verdict is in the copy, and a state that is in the copy
+       without a verdict is processed again after a resume */
+    for (int state_index = 0; state_index < analysis->nstates; state_index++)
+    {
+        verdicts[state_index] = atomic_load_explicit(&analysis->verdicts[state_index], memory_order_acquire);
+    }
+    for (size_t i = 0; i < nwords; i++)
+    {
+        visited[i] = atomic_load_explicit(&analysis->visited[i], memory_order_relaxed);
+    }
+
+    int64_t header[ANALYSIS_CHECKPOINT_FIELDS] = {
+        ANALYSIS_CHECKPOINT_MAGIC, checkpoint->look_ahead_steps, checkpoint->safety_distance,
+        adaptive_look_ahead, checkpoint->model_hash, get_map_hash(map), map->width, map->height,
+        analysis->nstates};
+    const void *blocks[3] = {header, visited, verdicts};
+    size_t sizes[3] = {sizeof(header), nwords * sizeof(unsigned long), analysis->nstates};
+    int ok = replace_file(checkpoint->path, blocks, sizes, 3);
+
+    free(visited);
+    free(verdicts);
+    return ok;
+}
+
+int read_analysis_checkpoint(struct AnalysisCheckpoint *checkpoint)
+{
+    const Map *map = checkpoint->map;
+    struct SharedAnalysis *analysis = checkpoint->analysis;
+    FILE *file = fopen(checkpoint->path, "rb");
+    if (file == NULL)
+    {
+        perror(checkpoint->path);
+        return 0;
+    }
+
+    int64_t header[ANALYSIS_CHECKPOINT_FIELDS];
+    int64_t expected[ANALYSIS_CHECKPOINT_FIELDS] = {
+        ANALYSIS_CHECKPOINT_MAGIC, checkpoint->look_ahead_steps, checkpoint->safety_distance,
+        adaptive_look_ahead, checkpoint->model_hash, get_map_hash(map), map->width, map->height,
+        analysis->nstates};
+    if (fread(header, sizeof(header), 1, file) != 1 || memcmp(header, expected, sizeof(expected)) != 0)
+    {
+        fprintf(stderr, "%s does not belong to this analysis\n", checkpoint->path);
+        fclose(file);
+        return 0;
+    }
+
+    int bits = 8 * sizeof(unsigned long);
+    size_t nwords = (analysis->nstates + bits - 1) / bits;
+    unsigned char *verdicts = malloc(analysis->nstates);
+    unsigned long *visited = malloc(nwords * sizeof(unsigned long));
+    int ok = fread(visited, sizeof(unsigned long), nwords, file) == nwords &&
+             fread(verdicts, 1, analysis->nstates, file) == (size_t)analysis->nstates;
+    fclose(file);
+    if (ok)
+    {
+        for (size_t i = 0; i < nwords; i++)
+        {
+            atomic_store(&analysis->visited[i], visited[i]);
+        }
+        for (int state_index = 0; state_index < analysis->nstates; state_index++)
+        {
+            atomic_store(&analysis->verdicts[state_index], verdicts[state_index]);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "%s is truncated\n", checkpoint->path);
+    }
+
+    free(visited);
+    free(verdicts);
+    return ok;
+}
+
+void *run_analysis_checkpoint_thread(void *argument)
+{
+    struct AnalysisCheckpoint *checkpoint = argument;
+    pthread_mutex_lock(&checkpoint->mutex);
+    while (!checkpoint->done)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += checkpoint->interval;
+        int result = 0;
+        while (!checkpoint->done && result != ETIMEDOUT)
+        {
+            result = pthread_cond_timedwait(&checkpoint->condition, &checkpoint->mutex, &deadline);
+        }
+        if (!checkpoint->done)
+        {
+            pthread_mutex_unlock(&checkpoint->mutex);
+            write_analysis_checkpoint(checkpoint);
+            pthread_mutex_lock(&checkpoint->mutex);
+        }
+    }
+    pthread_mutex_unlock(&checkpoint->mutex);
+    return NULL;
+}
+
+int read_fully(int fd, void *buffer, size_t size)
+{
+    char *bytes = buffer;
+    while (size > 0)
+    {
+        ssize_t nread = read(fd, bytes, size);
+        if (nread <= 0)
+        {
+            return 0;
+        }
+        bytes += nread;
+        size -= nread;
+    }
+    return 1;
+}
+
+int write_fully(int fd, const void *buffer, size_t size)
+{
+    const char *bytes = buffer;
+    while (size > 0)
+    {
+        /* a closed client must not raise SIGPIPE in a long running service */
+        ssize_t nwritten = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (nwritten <= 0)
+        {
+            return 0;
+        }
+        bytes += nwritten;
+        size -= nwritten;
+    }
+    return 1;
+}
+
+void serve_connection(const Map *map, int fd, NNContext **nn_contexts, int nmodels,
+                      int32_t *request, int32_t *response, int look_ahead_steps, int safety_distance)
+{
+    uint32_t length;
+    while (read_fully(fd, &length, sizeof(length)))
+    {
+        /* a malformed request ends the connection, since the stream cannot be resynchronized */
+        size_t state_size = 4 * sizeof(int32_t);
+        if (length < sizeof(int32_t) || (length - sizeof(int32_t)) % state_size != 0 ||
+            (length - sizeof(int32_t)) / state_size > SERVICE_BATCH_LIMIT)
+        {
+            return;
+        }
+        if (!read_fully(fd, request, length))
+        {
+            return;
+        }
+
+        int model_index = request[0];
+        int nstates = (length - sizeof(int32_t)) / state_size;
+        response[0] = nstates * 3 * sizeof(int32_t);
+        for (int i = 0; i < nstates; i++)
+        {
+            int32_t *values = &request[1 + 4 * i];
+            int32_t *result = &response[1 + 3 * i];
+            Position position = {values[0], values[1]};
+            Velocity velocity = {values[2], values[3]};
+            State state = {&position, &velocity};
+            result[0] = 0;
+            result[1] = 0;
+            result[2] = 0;
+            if (model_index < 0 || model_index >= nmodels || !is_valid_position(map, &position) ||
+                abs(velocity.x) > velocity_limit_x || abs(velocity.y) > velocity_limit_y)
+            {
+                continue;
+            }
+            /* compute_acceleration without allocations */
+            int action = get_nn_context_action(nn_contexts[model_index], map, &state);
+            if (action < 0)
+            {
+                continue;
+            }
+            int sign = look_ahead_check(map, &state, nn_contexts[model_index], look_ahead_steps,
+                                        safety_distance) ? 1 : -1;
+            result[0] = 1;
+            result[1] = sign * (action / 3 - 1);
+            result[2] = sign * (action % 3 - 1);
+        }
+        if (!write_fully(fd, response, sizeof(int32_t) + response[0]))
+        {
+            return;
+        }
+    }
+}
+
+void *run_service_connection(void *argument)
+{
+    struct ServiceConnection *connection = argument;
+    int nmodels = connection->nmodels;
+    NNContext **nn_contexts = calloc(nmodels, sizeof(NNContext *));
+    /* buffers of the largest request and response, reused for every request */
+    int32_t *request = malloc(sizeof(int32_t) + SERVICE_BATCH_LIMIT * 4 * sizeof(int32_t));
+    int32_t *response = malloc(sizeof(int32_t) + SERVICE_BATCH_LIMIT * 3 * sizeof(int32_t));
+    int ok = nn_contexts != NULL && request != NULL && response != NULL;
+    for (int i = 0; i < nmodels && ok; i++)
+    {
+        nn_contexts[i] = create_nn_context(connection->nn_models[i]);
+        ok = nn_contexts[i] != NULL;
+    }
+    if (ok)
+    {
+        serve_connection(connection->map, connection->fd, nn_contexts, nmodels, request, response,
+                         connection->look_ahead_steps, connection->safety_distance);
+    }
+    else
+    {
+        fprintf(stderr, "out of memory, connection closed\n");
+    }
+    close(connection->fd);
+    free(request);
+    free(response);
+    for (int i = 0; nn_contexts != NULL && i < nmodels; i++)
+    {
+        if (nn_contexts[i] != NULL)
+        {
+            delete_nn_context(nn_contexts[i]);
+        }
+    }
+    free(nn_contexts);
+    release_service_slot(connection->slots);
+    free(connection);
+    return NULL;
+}
+
+void release_service_slot(struct ServiceSlots *slots)
+{
+    pthread_mutex_lock(&slots->mutex);
+    slots->nconnections--;
+    pthread_cond_signal(&slots->condition);
+    pthread_mutex_unlock(&slots->mutex);
+}
+
+int run_controller_service(const Map *map, const char *socket_path, char **nn_model_directories,
+                           int nmodels, int look_ahead_steps, int safety_distance)
+{
+    struct sockaddr_un address;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "socket path is too long: %s\n", socket_path);
+        return 0;
+    }
+    NNModel **nn_models = malloc(nmodels * sizeof(NNModel *));
+    for (int i = 0; i < nmodels; i++)
+    {
+        nn_models[i] = load_nn_model(nn_model_directories[i]);
+        if (nn_models[i] == NULL)
+        {
+            for (int j = 0; j < i; j++)
+            {
+                delete_nn_model(nn_models[j]);
+            }
+            free(nn_models);
+            return 0;
+        }
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    /* only a stale socket is replaced, never another kind of file */
+    int ok = server >= 0;
+    struct stat socket_stat;
+    if (ok && lstat(socket_path, &socket_stat) == 0)
+    {
+        if (!S_ISSOCK(socket_stat.st_mode))
+        {
+            errno = ENOTSOCK;
+            ok = 0;
+        }
+        else if (unlink(socket_path) < 0 && errno != ENOENT)
+        {
+            ok = 0;
+        }
+    }
+    if (!ok || bind(server, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(server, 16) < 0)
+    {
+        perror(socket_path);
+        if (server >= 0)
+        {
+            close(server);
+        }
+        for (int i = 0; i < nmodels; i++)
+        {
+            delete_nn_model(nn_models[i]);
+        }
+        free(nn_models);
+        return 0;
+    }
+
+    /* every connection is served by its own thread with its own inference contexts, the sessions
+       of the models are shared. Beyond SERVICE_CONNECTION_LIMIT open connections, new clients wait
+       in the listen backlog until a connection is closed */
+    struct ServiceSlots slots;
+    pthread_mutex_init(&slots.mutex, NULL);
+    pthread_cond_init(&slots.condition, NULL);
+    slots.nconnections = 0;
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    for (;;)
+    {
+        pthread_mutex_lock(&slots.mutex);
+        while (slots.nconnections >= SERVICE_CONNECTION_LIMIT)
+        {
+            pthread_cond_wait(&slots.condition, &slots.mutex);
+        }
+        slots.nconnections++;
+        pthread_mutex_unlock(&slots.mutex);
+
+        int client = accept(server, NULL, NULL);
+        struct ServiceConnection *connection = client >= 0 ? malloc(sizeof(struct ServiceConnection)) : NULL;
+        if (connection == NULL)
+        {
+            if (client >= 0)
+            {
+                close(client);
+            }
+            release_service_slot(&slots);
+            continue;
+        }
+        connection->map = map;
+        connection->fd = client;
+        connection->nn_models = nn_models;
+        connection->nmodels = nmodels;
+        connection->look_ahead_steps = look_ahead_steps;
+        connection->safety_distance = safety_distance;
+        connection->slots = &slots;
+        pthread_t thread;
+        if (pthread_create(&thread, &attributes, run_service_connection, connection) != 0)
+        {
+            close(client);
+            free(connection);
+            release_service_slot(&slots);
+        }
+    }
+}
+
+float *get_cell_features(const Map *map)
+{
+    float *cell_features = malloc(map->width * map->height * CELL_FEATURES * sizeof(float));
+    Velocity velocity = {0, 0};
+    for (int x = 0; x < map->width; x++)
+    {
+        for (int y = 0; y < map->height; y++)
+        {
+            Position position = {x, y};
+            State state = {&position, &velocity};
+            float feature_values[INPUT_SIZE];
+            fill_feature_values(map, &state, feature_values);
+            memcpy(&cell_features[(x * map->height + y) * CELL_FEATURES], &feature_values[4],
+                   CELL_FEATURES * sizeof(float));
+        }
+    }
+    return cell_features;
+}
+
+int get_abstract_action(const Map *map, const struct StateBox *box, const float *cell_features,
+                        const NNWeights *nn_weights)
+{
+    double lower[INPUT_SIZE];
+    double upper[INPUT_SIZE];
+    lower[0] = box->x_lower;
+    upper[0] = box->x_upper;
+    lower[1] = box->y_lower;
+    upper[1] = box->y_upper;
+    lower[2] = box->vx_lower;
+    upper[2] = box->vx_upper;
+    lower[3] = box->vy_lower;
+    upper[3] = box->vy_upper;
+    for (int i = 4; i < INPUT_SIZE; i++)
+    {
+        lower[i] = INFINITY;
+        upper[i] = -INFINITY;
+    }
+
+    /* position dependent features are bounded over the free cells of the box */
+    for (int x = box->x_lower; x <= box->x_upper; x++)
+    {
+        for (int y = box->y_lower; y <= box->y_upper; y++)
+        {
+            if (map->grid[x][y] == 'x')
+            {
+                continue;
+            }
+            const float *features = &cell_features[(x * map->height + y) * CELL_FEATURES];
+            for (int i = 0; i < CELL_FEATURES; i++)
+            {
+                lower[4 + i] = fmin(lower[4 + i], features[i]);
+                upper[4 + i] = fmax(upper[4 + i], features[i]);
+            }
+        }
+    }
+    if (lower[4] > upper[4])
+    {
+        /* no free cell */
+        return -1;
+    }
+
+    double q_lower[OUTPUT_SIZE];
+    double q_upper[OUTPUT_SIZE];
+    call_nn_weights(nn_weights, lower, upper, q_lower, q_upper);
+
+    /* the argmax is unambiguous if one lower bound exceeds all other upper bounds */
+    for (int i = 0; i < OUTPUT_SIZE; i++)
+    {
+        int dominates = 1;
+        for (int j = 0; j < OUTPUT_SIZE && dominates; j++)
+        {
+            if (j != i && q_lower[i] <= q_upper[j])
+            {
+                dominates = 0;
+            }
+        }
+        if (dominates)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int check_box(const Map *map, const struct StateBox *box, const float *cell_features,
+              const NNWeights *nn_weights, int look_ahead_steps, struct AbstractResult *result)
+{
+    /* mirrors compute_acceleration: the first network decision is kept if the look ahead
+       succeeds for every state in the box, successors are over-approximated by boxes */
+    int steps = look_ahead_steps > 1 ? look_ahead_steps : 1;
+    struct StateBox current = *box;
+    int first_action = -1;
+    for (int step = 0; step < steps; step++)
+    {
+        int action = get_abstract_action(map, &current, cell_features, nn_weights);
+        result->boxes++;
+        if (action < 0)
+        {
+            return BOX_UNKNOWN;
+        }
+        if (step == 0)
+        {
+            first_action = action;
+        }
+        Acceleration acceleration = {action / 3 - 1, action % 3 - 1};
+
+        int x_lower = map->width, x_upper = -1, y_lower = map->height, y_upper = -1;
+        for (int x = current.x_lower; x <= current.x_upper; x++)
+        {
+            for (int y = current.y_lower; y <= current.y_upper; y++)
+            {
+                if (map->grid[x][y] == 'x')
+                {
+                    continue;
+                }
+                for (int vx = current.vx_lower; vx <= current.vx_upper; vx++)
+                {
+                    for (int vy = current.vy_lower; vy <= current.vy_upper; vy++)
+                    {
+                        Position position = {x, y};
+                        Velocity velocity = {vx, vy};
+                        State state = {&position, &velocity};
+                        if (!is_valid_acceleration(map, &state, &acceleration))
+                        {
+                            return BOX_UNKNOWN;
+                        }
+                        int next_x = x + vx + acceleration.x;
+                        int next_y = y + vy + acceleration.y;
+                        x_lower = next_x < x_lower ? next_x : x_lower;
+                        x_upper = next_x > x_upper ? next_x : x_upper;
+                        y_lower = next_y < y_lower ? next_y : y_lower;
+                        y_upper = next_y > y_upper ? next_y : y_upper;
+                    }
+                }
+            }
+        }
+        if (step == 0 && look_ahead_steps < 1)
+        {
+            break;
+        }
+
+        struct StateBox next = {
+            x_lower, x_upper, y_lower, y_upper,
+            current.vx_lower + acceleration.x, current.vx_upper + acceleration.x,
+            current.vy_lower + acceleration.y, current.vy_upper + acceleration.y};
+        /* valid successors respect the velocity limits */
+        next.vx_lower = next.vx_lower < -velocity_limit_x ? -velocity_limit_x : next.vx_lower;
+        next.vx_upper = next.vx_upper > velocity_limit_x ? velocity_limit_x : next.vx_upper;
+        next.vy_lower = next.vy_lower < -velocity_limit_y ? -velocity_limit_y : next.vy_lower;
+        next.vy_upper = next.vy_upper > velocity_limit_y ? velocity_limit_y : next.vy_upper;
+        current = next;
+    }
+    return first_action >= 0 ? BOX_SAFE : BOX_UNKNOWN;
+}
+
+void analyze_box(const Map *map, const struct StateBox *box, const float *cell_features,
+                 const NNWeights *nn_weights, NNContext *nn_context, int look_ahead_steps,
+                 int safety_distance, struct AbstractResult *result)
+{
+    long nfree = 0;
+    for (int x = box->x_lower; x <= box->x_upper; x++)
+    {
+        for (int y = box->y_lower; y <= box->y_upper; y++)
+        {
+            nfree += map->grid[x][y] != 'x';
+        }
+    }
+    if (nfree == 0)
+    {
+        return;
+    }
+    long nvelocities = (long)(box->vx_upper - box->vx_lower + 1) * (box->vy_upper - box->vy_lower + 1);
+
+    if (check_box(map, box, cell_features, nn_weights, look_ahead_steps, result) == BOX_SAFE)
+    {
+        result->certified += nfree * nvelocities;
+        return;
+    }
+
+    int widths[4] = {box->x_upper - box->x_lower, box->y_upper - box->y_lower,
+                     box->vx_upper - box->vx_lower, box->vy_upper - box->vy_lower};
+    int dimension = 0;
+    for (int i = 1; i < 4; i++)
+    {
+        if (widths[i] > widths[dimension])
+        {
+            dimension = i;
+        }
+    }
+
+    if (widths[dimension] == 0)
+    {
+        /* a single state, the ambiguity is resolved by the network itself */
+        Position position = {box->x_lower, box->y_lower};
+        Velocity velocity = {box->vx_lower, box->vy_lower};
+        State state = {&position, &velocity};
+        Acceleration *acceleration = compute_acceleration(map, &state, nn_context, look_ahead_steps,
+                                                          safety_distance);
+        result->concrete++;
+        result->inferences += 1 + (look_ahead_steps > 0 ? look_ahead_steps : 0);
+        State *next_state = acceleration != NULL ? get_next_state(map, &state, acceleration) : NULL;
+        if (next_state == NULL)
+        {
+            result->crashes++;
+        }
+        else
+        {
+            delete_state(next_state);
+        }
+        if (acceleration != NULL)
+        {
+            delete_acceleration(acceleration);
+        }
+        return;
+    }
+
+    struct StateBox lower_half = *box;
+    struct StateBox upper_half = *box;
+    int *lower_bounds[4] = {&upper_half.x_lower, &upper_half.y_lower, &upper_half.vx_lower, &upper_half.vy_lower};
+    int *upper_bounds[4] = {&lower_half.x_upper, &lower_half.y_upper, &lower_half.vx_upper, &lower_half.vy_upper};
+    int middle = *upper_bounds[dimension] - (widths[dimension] + 1) / 2;
+    *upper_bounds[dimension] = middle;
+    *lower_bounds[dimension] = middle + 1;
+    analyze_box(map, &lower_half, cell_features, nn_weights, nn_context, look_ahead_steps,
+                safety_distance, result);
+    analyze_box(map, &upper_half, cell_features, nn_weights, nn_context, look_ahead_steps,
+                safety_distance, result);
+}
+
+int run_abstract_analysis(const Map *map, const char *nn_model_directory, int look_ahead_steps,
+                          int safety_distance)
+{
+    NNModel *nn_model = load_nn_model(nn_model_directory);
+    if (nn_model == NULL)
+    {
+        return 0;
+    }
+    NNWeights *nn_weights = get_nn_weights(nn_model);
+    if (nn_weights == NULL)
+    {
+        fprintf(stderr, "%s is not a network of dense layers\n", nn_model_directory);
+        delete_nn_model(nn_model);
+        return 0;
+    }
+    NNContext *nn_context = create_nn_context(nn_model);
+    float *cell_features = get_cell_features(map);
+
+    struct AbstractResult result = {0, 0, 0, 0, 0};
+    struct StateBox box = {0, map->width - 1, 0, map->height - 1,
+                           -velocity_limit_x, velocity_limit_x, -velocity_limit_y, velocity_limit_y};
+    analyze_box(map, &box, cell_features, nn_weights, nn_context, look_ahead_steps, safety_distance,
+                &result);
+    printf("states: %ld certified: %ld concrete: %ld crashes: %ld boxes: %ld inferences: %ld\n",
+           result.certified + result.concrete, result.certified, result.concrete, result.crashes,
+           result.boxes, result.inferences);
+
+    free(cell_features);
+    delete_nn_context(nn_context);
+    delete_nn_weights(nn_weights);
+    delete_nn_model(nn_model);
+    return result.crashes == 0;
+}
+
+TF_Tensor *evaluate_nn_output(const NNModel *nn_model, TF_Output output)
+{
+    TF_Tensor *output_values[1] = {NULL};
+    TF_SessionRun(nn_model->session, NULL, NULL, NULL, 0, &output, output_values, 1, NULL, 0, NULL,
+                  nn_model->status);
+    if (TF_GetCode(nn_model->status) != TF_OK)
+    {
+        return NULL;
+    }
+    return output_values[0];
+}
+
+NNWeights *get_nn_weights(const NNModel *nn_model)
+{
+    /* walks from the output back to the input, expecting MatMul -> BiasAdd -> Relu chains */
+    int nlayers = 0;
+    int layers_size = 4;
+    struct DenseLayer *layers = malloc(layers_size * sizeof(struct DenseLayer));
+    float *bias = NULL;
+    int bias_size = 0;
+    int relu = 0;
+    int supported = 1;
+    TF_Operation *operation = nn_model->output.oper;
+    while (operation != nn_model->input.oper)
+    {
+        const char *type = TF_OperationOpType(operation);
+        TF_Input data = {operation, 0};
+        if (strcmp(type, "Relu") == 0)
+        {
+            relu = 1;
+        }
+        else if (strcmp(type, "BiasAdd") == 0 || strcmp(type, "Add") == 0 || strcmp(type, "AddV2") == 0)
+        {
+            TF_Input parameter = {operation, 1};
+            TF_Tensor *tensor = evaluate_nn_output(nn_model, TF_OperationInput(parameter));
+            if (tensor == NULL || bias != NULL)
+            {
+                TF_DeleteTensor(tensor);
+                supported = 0;
+                break;
+            }
+            bias_size = TF_TensorByteSize(tensor) / sizeof(float);
+            bias = malloc(bias_size * sizeof(float));
+            memcpy(bias, TF_TensorData(tensor), bias_size * sizeof(float));
+            TF_DeleteTensor(tensor);
+        }
+        else if (strcmp(type, "MatMul") == 0)
+        {
+            TF_Input parameter = {operation, 1};
+            unsigned char transpose_a = 0;
+            unsigned char transpose_b = 0;
+            /* an attribute that cannot be read would leave the orientation of the kernel unknown */
+            TF_OperationGetAttrBool(operation, "transpose_a", &transpose_a, nn_model->status);
+            if (TF_GetCode(nn_model->status) != TF_OK)
+            {
+                supported = 0;
+                break;
+            }
+            TF_OperationGetAttrBool(operation, "transpose_b", &transpose_b, nn_model->status);
+            if (TF_GetCode(nn_model->status) != TF_OK)
+            {
+                supported = 0;
+                break;
+            }
+            TF_Tensor *tensor = evaluate_nn_output(nn_model, TF_OperationInput(parameter));
+            if (tensor == NULL || transpose_a || TF_NumDims(tensor) != 2)
+            {
+                TF_DeleteTensor(tensor);
+                supported = 0;
+                break;
+            }
+            int rows = TF_Dim(tensor, 0);
+            int columns = TF_Dim(tensor, 1);
+            struct DenseLayer layer;
+            layer.ninputs = transpose_b ? columns : rows;
+            layer.noutputs = transpose_b ? rows : columns;
+            layer.kernel = malloc(rows * columns * sizeof(float));
+            const float *values = TF_TensorData(tensor);
+            for (int i = 0; i < layer.ninputs; i++)
+            {
+                for (int j = 0; j < layer.noutputs; j++)
+                {
+                    layer.kernel[i * layer.noutputs + j] =
+                        transpose_b ? values[j * columns + i] : values[i * columns + j];
+                }
+            }
+            TF_DeleteTensor(tensor);
+            if (bias != NULL && bias_size != layer.noutputs)
+            {
+                free(layer.kernel);
+                supported = 0;
+                break;
+            }
+            layer.bias = bias != NULL ? bias : calloc(layer.noutputs, sizeof(float));
+            layer.relu = relu;
+            bias = NULL;
+            relu = 0;
+            if (nlayers == layers_size)
+            {
+                layers_size *= 2;
+                layers = realloc(layers, layers_size * sizeof(struct DenseLayer));
+            }
+            layers[nlayers] = layer;
+            nlayers++;
+        }
+        else if (strcmp(type, "Identity") != 0)
+        {
+            supported = 0;
+            break;
+        }
+        operation = TF_OperationInput(data).oper;
+        if (operation == NULL)
+        {
+            supported = 0;
+            break;
+        }
+    }
+
+    NNWeights *nn_weights = malloc(sizeof(NNWeights));
+    nn_weights->nlayers = nlayers;
+    nn_weights->layers = layers;
+    nn_weights->center = NULL;
+    nn_weights->radius = NULL;
+    nn_weights->next_center = NULL;
+    nn_weights->next_radius = NULL;
+    nn_weights->next_magnitude = NULL;
+    /* a bias or a Relu without a following MatMul belongs to a layer that is not supported */
+    supported = supported && bias == NULL && !relu;
+    free(bias);
+
+    /* layers were collected from the output, restore the forward order and check the shapes */
+    for (int i = 0; i < nlayers / 2; i++)
+    {
+        struct DenseLayer layer = layers[i];
+        layers[i] = layers[nlayers - 1 - i];
+        layers[nlayers - 1 - i] = layer;
+    }
+    int width = INPUT_SIZE;
+    int ninputs = INPUT_SIZE;
+    for (int i = 0; i < nlayers && supported; i++)
+    {
+        supported = layers[i].ninputs == ninputs;
+        ninputs = layers[i].noutputs;
+        width = ninputs > width ? ninputs : width;
+    }
+    if (!supported || nlayers == 0 || ninputs != OUTPUT_SIZE)
+    {
+        delete_nn_weights(nn_weights);
+        return NULL;
+    }
+    nn_weights->center = malloc(width * sizeof(double));
+    nn_weights->radius = malloc(width * sizeof(double));
+    nn_weights->next_center = malloc(width * sizeof(double));
+    nn_weights->next_radius = malloc(width * sizeof(double));
+    nn_weights->next_magnitude = malloc(width * sizeof(double));
+    return nn_weights;
+}
+
+void call_nn_weights(const NNWeights *nn_weights, const double *lower, const double *upper,
+                     double *q_lower, double *q_upper)
+{
+    double *center = nn_weights->center;
+    double *radius = nn_weights->radius;
+    double *next_center = nn_weights->next_center;
+    double *next_radius = nn_weights->next_radius;
+    double *next_magnitude = nn_weights->next_magnitude;
+    for (int i = 0; i < INPUT_SIZE; i++)
+    {
+        center[i] = 0.5 * (lower[i] + upper[i]);
+        radius[i] = 0.5 * (upper[i] - lower[i]);
+    }
+
+    for (int l = 0; l < nn_weights->nlayers; l++)
+    {
+        const struct DenseLayer *layer = &nn_weights->layers[l];
+        int noutputs = layer->noutputs;
+        for (int j = 0; j < noutputs; j++)
+        {
+            next_center[j] = layer->bias[j];
+            next_radius[j] = 0.0;
+            next_magnitude[j] = fabs(layer->bias[j]);
+        }
+        /* rows of the kernel are contiguous, so the inner loops vectorize */
+        for (int i = 0; i < layer->ninputs; i++)
+        {
+            const float *row = &layer->kernel[i * noutputs];
+            double c = center[i];
+            double r = radius[i];
+            double m = fabs(c) + r;
+            for (int j = 0; j < noutputs; j++)
+            {
+                next_center[j] += row[j] * c;
+                next_radius[j] += fabs(row[j]) * r;
+                next_magnitude[j] += fabs(row[j]) * m;
+            }
+        }
+        for (int j = 0; j < noutputs; j++)
+        {
+            /* the rounding error of a float sum grows with the magnitudes of its terms, not with
+               the result, which can be close to zero when the terms cancel */
+            double slack = BOUND_SLACK * next_magnitude[j];
+            double l_j = next_center[j] - next_radius[j] - slack;
+            double u_j = next_center[j] + next_radius[j] + slack;
+            if (layer->relu)
+            {
+                l_j = l_j > 0.0 ? l_j : 0.0;
+                u_j = u_j > 0.0 ? u_j : 0.0;
+            }
+            center[j] = 0.5 * (l_j + u_j);
+            radius[j] = 0.5 * (u_j - l_j);
+        }
+    }
+
+    for (int j = 0; j < OUTPUT_SIZE; j++)
+    {
+        q_lower[j] = center[j] - radius[j];
+        q_upper[j] = center[j] + radius[j];
+    }
+}
+
+void delete_nn_weights(NNWeights *nn_weights)
+{
+    for (int i = 0; i < nn_weights->nlayers; i++)
+    {
+        free(nn_weights->layers[i].kernel);
+        free(nn_weights->layers[i].bias);
+    }
+    free(nn_weights->layers);
+    free(nn_weights->center);
+    free(nn_weights->radius);
+    free(nn_weights->next_center);
+    free(nn_weights->next_radius);
+    free(nn_weights->next_magnitude);
+    free(nn_weights);
+}
+
+Statistics *create_statistics(const Map *map, int nshards)
+{
+    Statistics *statistics = malloc(sizeof(Statistics));
+    statistics->width = map->width;
+    statistics->height = map->height;
+    statistics->nshards = nshards > 0 ? nshards : 1;
+    size_t ncounters = (size_t)statistics->nshards * map->width * map->height * VELOCITY_BUCKETS *
+                       STATISTICS_COUNTERS;
+    statistics->counters = malloc(ncounters * sizeof(atomic_ulong));
+    for (size_t i = 0; i < ncounters; i++)
+    {
+        atomic_init(&statistics->counters[i], 0);
+    }
+    return statistics;
+}
+
+void record_statistics(Statistics *statistics, int shard, const State *state, int counter)
+{
+    if (statistics == NULL)
+    {
+        return;
+    }
+    Position *position = state->position;
+    Velocity *velocity = state->velocity;
+    int vx = abs(velocity->x);
+    int vy = abs(velocity->y);
+    int bucket = vx > vy ? vx : vy;
+    bucket = bucket < VELOCITY_BUCKETS ? bucket : VELOCITY_BUCKETS - 1;
+    size_t cell = (size_t)(shard % statistics->nshards) * statistics->width * statistics->height +
+                  position->x * statistics->height + position->y;
+    size_t index = (cell * VELOCITY_BUCKETS + bucket) * STATISTICS_COUNTERS + counter;
+    /* counters are only read after the recording threads are done, no ordering is needed */
+    atomic_fetch_add_explicit(&statistics->counters[index], 1, memory_order_relaxed);
+}
+
+unsigned long get_statistics(const Statistics *statistics, int x, int y, int bucket, int counter)
+{
+    unsigned long total = 0;
+    size_t ncells = (size_t)statistics->width * statistics->height;
+    for (int shard = 0; shard < statistics->nshards; shard++)
+    {
+        size_t cell = shard * ncells + x * statistics->height + y;
+        size_t index = (cell * VELOCITY_BUCKETS + bucket) * STATISTICS_COUNTERS + counter;
+        total += atomic_load_explicit(&statistics->counters[index], memory_order_relaxed);
+    }
+    return total;
+}
+
+int write_statistics(const Statistics *statistics, const char *prefix)
+{
+    const char *names[STATISTICS_COUNTERS] = {"visits", "fallbacks", "crashes", "goals"};
+    size_t filename_size = strlen(prefix) + 16;
+    char *filename = malloc(filename_size);
+
+    /* per cell totals in the layout of the map csv files, with a line per y and a column per x */
+    for (int counter = 0; counter < STATISTICS_COUNTERS; counter++)
+    {
+        snprintf(filename, filename_size, "%s.%s.csv", prefix, names[counter]);
+        FILE *file = fopen(filename, "w");
+        if (file == NULL)
+        {
+            perror(filename);
+            free(filename);
+            return 0;
+        }
+        for (int y = 0; y < statistics->height; y++)
+        {
+            for (int x = 0; x < statistics->width; x++)
+            {
+                unsigned long total = 0;
+                for (int bucket = 0; bucket < VELOCITY_BUCKETS; bucket++)
+                {
+                    total += get_statistics(statistics, x, y, bucket, counter);
+                }
+                fprintf(file, x == 0 ? "%lu" : ",%lu", total);
+            }
+            fprintf(file, "\n");
+        }
+        fclose(file);
+    }
+
+    /* all counters, header of int32 (width, height, buckets, counters) then uint64 counts
+       indexed by x, y, bucket and counter */
+    snprintf(filename, filename_size, "%s.bin", prefix);
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        perror(filename);
+        free(filename);
+        return 0;
+    }
+    int32_t header[4] = {statistics->width, statistics->height, VELOCITY_BUCKETS, STATISTICS_COUNTERS};
+    fwrite(header, sizeof(header), 1, file);
+    for (int x = 0; x < statistics->width; x++)
+    {
+        for (int y = 0; y < statistics->height; y++)
+        {
+            uint64_t counts[VELOCITY_BUCKETS * STATISTICS_COUNTERS];
+            for (int bucket = 0; bucket < VELOCITY_BUCKETS; bucket++)
+            {
+                for (int counter = 0; counter < STATISTICS_COUNTERS; counter++)
+                {
+                    counts[bucket * STATISTICS_COUNTERS + counter] =
+                        get_statistics(statistics, x, y, bucket, counter);
+                }
+            }
+            fwrite(counts, sizeof(counts), 1, file);
+        }
+    }
+    int ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    free(filename);
+    return ok;
+}
+
+void delete_statistics(Statistics *statistics)
+{
+    free(statistics->counters);
+    free(statistics);
+}
+
+unsigned long get_random(unsigned long *random_state)
+{
+    /* splitmix64 */
+    unsigned long z = (*random_state += 0x9e3779b97f4a7c15UL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    return z ^ (z >> 31);
+}
+
+void record_event(const Map *map, struct EpisodeTrace *trace, const State *state, int counter)
+{
+    if (trace == NULL)
+    {
+        return;
+    }
+    if (trace->nevents == trace->size)
+    {
+        trace->size = trace->size > 0 ? 2 * trace->size : 64;
+        trace->events = realloc(trace->events, trace->size * sizeof(struct EpisodeEvent));
+    }
+    trace->events[trace->nevents].state_index = get_state_index(map, state);
+    trace->events[trace->nevents].counter = counter;
+    trace->nevents++;
+}
+
+void commit_episode(struct Evaluation *evaluation, struct EpisodeTrace *trace, int shard, long episode,
+                    int success, const LatencyHistogram *latencies)
+{
+    const Map *map = evaluation->map;
+    int bits = 8 * sizeof(unsigned long);
+    /* shared with other committing threads, exclusive only against a checkpoint snapshot */
+    pthread_rwlock_rdlock(&evaluation->commit_lock);
+    for (int i = 0; i < trace->nevents; i++)
+    {
+        int state_index = trace->events[i].state_index;
+        Position position;
+        Velocity velocity;
+        get_indexed_state(map, state_index, &position, &velocity);
+        State state = {&position, &velocity};
+        record_statistics(evaluation->statistics, shard, &state, trace->events[i].counter);
+        atomic_fetch_or_explicit(&evaluation->visited[state_index / bits], 1UL << (state_index % bits),
+                                 memory_order_relaxed);
+    }
+    if (success)
+    {
+        atomic_fetch_add_explicit(&evaluation->successes, 1, memory_order_relaxed);
+    }
+    /* merged before the lock is released, so a checkpoint holds the latencies of exactly the
+       committed episodes */
+    pthread_mutex_lock(&evaluation->latency_mutex);
+    merge_latency_histogram(evaluation->latencies, latencies);
+    pthread_mutex_unlock(&evaluation->latency_mutex);
+    atomic_fetch_or_explicit(&evaluation->completed[episode / bits], 1UL << (episode % bits),
+                             memory_order_relaxed);
+    pthread_rwlock_unlock(&evaluation->commit_lock);
+    trace->nevents = 0;
+}
+
+void *run_evaluation_worker(void *argument)
+{
+    struct EvaluationWorker *worker = argument;
+    struct Evaluation *evaluation = worker->evaluation;
+    const Map *map = evaluation->map;
+    NNContext *nn_context = create_nn_context(evaluation->nn_model);
+    struct EpisodeTrace trace = {0, 0, NULL};
+    LatencyHistogram *episode_latencies = create_latency_histogram();
+    int bits = 8 * sizeof(unsigned long);
+    for (;;)
+    {
+        long episode = atomic_fetch_add(&evaluation->next_episode, 1);
+        if (episode >= evaluation->nepisodes || atomic_load(&evaluation->failed))
+        {
+            break;
+        }
+        if (atomic_load_explicit(&evaluation->completed[episode / bits], memory_order_relaxed) &
+            (1UL << (episode % bits)))
+        {
+            /* committed before the run was resumed */
+            continue;
+        }
+        /* every episode has its own random stream, so results do not depend on scheduling and
+           the episode index is the position of the stream */
+        unsigned long random_state = evaluation->seed ^ (episode * 0xd1b54a32d192ed03UL);
+        Velocity start_velocity = {0, 0};
+        State initial_state = {map->starts[get_random(&random_state) % map->nstarts], &start_velocity};
+        int success = run_safeguard_episode(map, &initial_state, nn_context, evaluation->step_limit,
+                                            evaluation->look_ahead_steps, evaluation->safety_distance,
+                                            evaluation->budget, &trace, episode_latencies);
+        if (success == EPISODE_ERROR)
+        {
+            /* the episode stays uncommitted, so a resumed run repeats it */
+            fprintf(stderr, "failed to run the model in episode %ld\n", episode);
+            atomic_store(&evaluation->failed, 1);
+            trace.nevents = 0;
+            reset_latency_histogram(episode_latencies);
+            break;
+        }
+        commit_episode(evaluation, &trace, worker->shard, episode, success, episode_latencies);
+
+        if (evaluation->latency_file != NULL)
+        {
+            pthread_mutex_lock(&evaluation->latency_mutex);
+            fprintf(evaluation->latency_file, "%ld,%ld,%ld,%ld,%ld,%ld\n", episode,
+                    get_latency_count(episode_latencies), get_latency_percentile(episode_latencies, 0.5),
+                    get_latency_percentile(episode_latencies, 0.99),
+                    get_latency_percentile(episode_latencies, 0.999), get_latency_max(episode_latencies));
+            pthread_mutex_unlock(&evaluation->latency_mutex);
+        }
+        reset_latency_histogram(episode_latencies);
+    }
+
+    delete_latency_histogram(episode_latencies);
+    free(trace.events);
+    delete_nn_context(nn_context);
+    return NULL;
+}
+
+int write_checkpoint(struct Evaluation *evaluation)
+{
+    const Map *map = evaluation->map;
+    const Statistics *statistics = evaluation->statistics;
+    int bits = 8 * sizeof(unsigned long);
+    size_t ncompleted = (evaluation->nepisodes + bits - 1) / bits;
+    size_t nvisited = (evaluation->nstates + bits - 1) / bits;
+    size_t ncounters = (size_t)map->width * map->height * VELOCITY_BUCKETS * STATISTICS_COUNTERS;
+    unsigned long *completed = malloc(ncompleted * sizeof(unsigned long));
+    unsigned long *visited = malloc(nvisited * sizeof(unsigned long));
+    uint64_t *counters = malloc(ncounters * sizeof(uint64_t));
+    /* count and maximum followed by the buckets of the map latency histogram */
+    int64_t *latencies = malloc((2 + LATENCY_BUCKETS) * sizeof(int64_t));
+
+    /* workers are only held back while the snapshot is copied, the file is written afterwards */
+    pthread_rwlock_wrlock(&evaluation->commit_lock);
+    for (size_t i = 0; i < ncompleted; i++)
+    {
+        completed[i] = atomic_load_explicit(&evaluation->completed[i], memory_order_relaxed);
+    }
+    for (size_t i = 0; i < nvisited; i++)
+    {
+        visited[i] = atomic_load_explicit(&evaluation->visited[i], memory_order_relaxed);
+    }
+    size_t index = 0;
+    for (int x = 0; x < map->width; x++)
+    {
+        for (int y = 0; y < map->height; y++)
+        {
+            for (int bucket = 0; bucket < VELOCITY_BUCKETS; bucket++)
+            {
+                for (int counter = 0; counter < STATISTICS_COUNTERS; counter++)
+                {
+                    counters[index] = get_statistics(statistics, x, y, bucket, counter);
+                    index++;
+                }
+            }
+        }
+    }
+    long successes = atomic_load_explicit(&evaluation->successes, memory_order_relaxed);
+    pthread_mutex_lock(&evaluation->latency_mutex);
+    latencies[0] = evaluation->latencies->count;
+    latencies[1] = evaluation->latencies->max;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        latencies[2 + i] = evaluation->latencies->counts[i];
+    }
+    pthread_mutex_unlock(&evaluation->latency_mutex);
+    pthread_rwlock_unlock(&evaluation->commit_lock);
+
+    int64_t header[CHECKPOINT_FIELDS] = {
+        CHECKPOINT_MAGIC, evaluation->nepisodes, evaluation->seed, evaluation->step_limit,
+        evaluation->look_ahead_steps, evaluation->safety_distance, evaluation->budget,
+        evaluation->model_hash, evaluation->map_hash, map->width, map->height, evaluation->nstates,
+        VELOCITY_BUCKETS * STATISTICS_COUNTERS, LATENCY_BUCKETS, successes};
+
+    const void *blocks[5] = {header, completed, visited, counters, latencies};
+    size_t sizes[5] = {sizeof(header), ncompleted * sizeof(unsigned long), nvisited * sizeof(unsigned long),
+                       ncounters * sizeof(uint64_t), (2 + LATENCY_BUCKETS) * sizeof(int64_t)};
+    int ok = replace_file(evaluation->checkpoint_path, blocks, sizes, 5);
+
+    free(latencies);
+    free(counters);
+    free(visited);
+    free(completed);
+    return ok;
+}
+
+int read_checkpoint(struct Evaluation *evaluation)
+{
+    const Map *map = evaluation->map;
+    FILE *file = fopen(evaluation->checkpoint_path, "rb");
+    if (file == NULL)
+    {
+        perror(evaluation->checkpoint_path);
+        return 0;
+    }
+
+    int64_t header[CHECKPOINT_FIELDS];
+    int64_t expected[CHECKPOINT_FIELDS - 1] = {
+        CHECKPOINT_MAGIC, evaluation->nepisodes, evaluation->seed, evaluation->step_limit,
+        evaluation->look_ahead_steps, evaluation->safety_distance, evaluation->budget,
+        evaluation->model_hash, evaluation->map_hash, map->width, map->height, evaluation->nstates,
+        VELOCITY_BUCKETS * STATISTICS_COUNTERS, LATENCY_BUCKETS};
+    if (fread(header, sizeof(header), 1, file) != 1 ||
+        memcmp(header, expected, sizeof(expected)) != 0)
+    {
+        fprintf(stderr, "%s does not belong to this evaluation\n", evaluation->checkpoint_path);
+        fclose(file);
+        return 0;
+    }
+
+    int bits = 8 * sizeof(unsigned long);
+    size_t ncompleted = (evaluation->nepisodes + bits - 1) / bits;
+    size_t nvisited = (evaluation->nstates + bits - 1) / bits;
+    size_t ncounters = (size_t)map->width * map->height * VELOCITY_BUCKETS * STATISTICS_COUNTERS;
+    unsigned long *completed = malloc(ncompleted * sizeof(unsigned long));
+    unsigned long *visited = malloc(nvisited * sizeof(unsigned long));
+    uint64_t *counters = malloc(ncounters * sizeof(uint64_t));
+    int64_t *latencies = malloc((2 + LATENCY_BUCKETS) * sizeof(int64_t));
+    int ok = fread(completed, sizeof(unsigned long), ncompleted, file) == ncompleted &&
+             fread(visited, sizeof(unsigned long), nvisited, file) == nvisited &&
+             fread(counters, sizeof(uint64_t), ncounters, file) == ncounters &&
+             fread(latencies, sizeof(int64_t), 2 + LATENCY_BUCKETS, file) == 2 + LATENCY_BUCKETS;
+    fclose(file);
+    if (ok)
+    {
+        for (size_t i = 0; i < ncompleted; i++)
+        {
+            atomic_store(&evaluation->completed[i], completed[i]);
+        }
+        for (size_t i = 0; i < nvisited; i++)
+        {
+            atomic_store(&evaluation->visited[i], visited[i]);
+        }
+        /* the merged counters are restored into the first shard */
+        for (size_t cell = 0; cell < ncounters / (VELOCITY_BUCKETS * STATISTICS_COUNTERS); cell++)
+        {
+            for (size_t i = 0; i < VELOCITY_BUCKETS * STATISTICS_COUNTERS; i++)
+            {
+                size_t index = cell * VELOCITY_BUCKETS * STATISTICS_COUNTERS + i;
+                atomic_store(&evaluation->statistics->counters[index], counters[index]);
+            }
+        }
+        atomic_store(&evaluation->successes, header[CHECKPOINT_FIELDS - 1]);
+        evaluation->latencies->count = latencies[0];
+        evaluation->latencies->max = latencies[1];
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+        {
+            evaluation->latencies->counts[i] = latencies[2 + i];
+        }
+    }
+    else
+    {
+        fprintf(stderr, "%s is truncated\n", evaluation->checkpoint_path);
+    }
+
+    free(latencies);
+    free(counters);
+    free(visited);
+    free(completed);
+    return ok;
+}
+
+int replace_file(const char *path, const void **blocks, const size_t *sizes, int nblocks)
+{
+    /* write a temporary file and rename it, so a crash never leaves a partial checkpoint, and sync
+       the directory, so the rename survives a power loss */
+    size_t temporary_path_size = strlen(path) + 5;
+    char *temporary_path = malloc(temporary_path_size);
+    snprintf(temporary_path, temporary_path_size, "%s.tmp", path);
+    FILE *file = fopen(temporary_path, "wb");
+    int ok = file != NULL;
+    if (ok)
+    {
+        for (int i = 0; i < nblocks; i++)
+        {
+            fwrite(blocks[i], 1, sizes[i], file);
+        }
+        ok = !ferror(file) && fflush(file) == 0 && fsync(fileno(file)) == 0;
+        ok = fclose(file) == 0 && ok;
+        ok = ok && rename(temporary_path, path) == 0 && sync_parent_directory(path);
+    }
+    if (!ok)
+    {
+        perror(temporary_path);
+    }
+    free(temporary_path);
+    return ok;
+}
+
+int sync_parent_directory(const char *path)
+{
+    /* dirname may modify its argument */
+    char *path_copy = strdup(path);
+    int fd = open(dirname(path_copy), O_RDONLY | O_DIRECTORY);
+    free(path_copy);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    int ok = fsync(fd) == 0;
+    return close(fd) == 0 && ok;
+}
+
+uint64_t get_hash(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3UL;
+    }
+    return hash;
+}
+
+uint64_t get_model_hash(const char *nn_model_directory)
+{
+    /* the same model reached by another relative path resolves to the same directory */
+    char model_path[PATH_MAX];
+    if (realpath(nn_model_directory, model_path) == NULL)
+    {
+        snprintf(model_path, sizeof(model_path), "%s", nn_model_directory);
+    }
+    return get_hash(HASH_OFFSET, model_path, strlen(model_path));
+}
+
+uint64_t get_map_hash(const Map *map)
+{
+    uint64_t hash = get_hash(HASH_OFFSET, &map->width, sizeof(map->width));
+    hash = get_hash(hash, &map->height, sizeof(map->height));
+    for (int x = 0; x < map->width; x++)
+    {
+        hash = get_hash(hash, map->grid[x], map->height);
+    }
+    return hash;
+}
+
+void *run_checkpoint_thread(void *argument)
+{
+    struct Evaluation *evaluation = argument;
+    pthread_mutex_lock(&evaluation->checkpoint_mutex);
+    while (!evaluation->done)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += evaluation->checkpoint_interval;
+        int result = 0;
+        while (!evaluation->done && result != ETIMEDOUT)
+        {
+            result = pthread_cond_timedwait(&evaluation->checkpoint_condition,
+                                            &evaluation->checkpoint_mutex, &deadline);
+        }
+        if (!evaluation->done)
+        {
+            pthread_mutex_unlock(&evaluation->checkpoint_mutex);
+            write_checkpoint(evaluation);
+            pthread_mutex_lock(&evaluation->checkpoint_mutex);
+        }
+    }
+    pthread_mutex_unlock(&evaluation->checkpoint_mutex);
+    return NULL;
+}
+
+int run_parallel_evaluation(const Map *map, const char *nn_model_directory, int nthreads, long nepisodes,
+                            unsigned long seed, int step_limit, int look_ahead_steps, int safety_distance,
+                            long budget, const char *statistics_prefix, const char *checkpoint_path,
+                            int checkpoint_interval, int resume)
+{
+    if (nthreads < 1 || map->nstarts == 0 || (resume && checkpoint_path == NULL))
+    {
+        return 0;
+    }
+
+    /* the session is shared, every thread owns an inference context */
+    NNModel *nn_model = load_nn_model(nn_model_directory);
+    if (nn_model == NULL)
+    {
+        return 0;
+    }
+
+    struct Evaluation evaluation;
+    evaluation.map = map;
+    evaluation.nn_model = nn_model;
+    evaluation.nepisodes = nepisodes;
+    evaluation.seed = seed;
+    evaluation.step_limit = step_limit;
+    evaluation.look_ahead_steps = look_ahead_steps;
+    evaluation.safety_distance = safety_distance;
+    evaluation.budget = budget;
+    evaluation.model_hash = get_model_hash(nn_model_directory);
+    evaluation.map_hash = get_map_hash(map);
+    evaluation.statistics = create_statistics(map, nthreads);
+    evaluation.latencies = create_latency_histogram();
+    evaluation.latency_file = NULL;
+    pthread_mutex_init(&evaluation.latency_mutex, NULL);
+    atomic_init(&evaluation.next_episode, 0);
+    atomic_init(&evaluation.successes, 0);
+    atomic_init(&evaluation.failed, 0);
+    int bits = 8 * sizeof(unsigned long);
+    size_t ncompleted = (nepisodes + bits - 1) / bits;
+    evaluation.nstates = get_state_count(map);
+    size_t nvisited = (evaluation.nstates + bits - 1) / bits;
+    evaluation.completed = malloc(ncompleted * sizeof(atomic_ulong));
+    evaluation.visited = malloc(nvisited * sizeof(atomic_ulong));
+    for (size_t i = 0; i < ncompleted; i++)
+    {
+        atomic_init(&evaluation.completed[i], 0);
+    }
+    for (size_t i = 0; i < nvisited; i++)
+    {
+        atomic_init(&evaluation.visited[i], 0);
+    }
+    pthread_rwlockattr_t commit_lock_attributes;
+    pthread_rwlockattr_init(&commit_lock_attributes);
+#ifdef __GLIBC__
+    /* a steady stream of commits must not starve the checkpoint */
+    pthread_rwlockattr_setkind_np(&commit_lock_attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&evaluation.commit_lock, &commit_lock_attributes);
+    pthread_rwlockattr_destroy(&commit_lock_attributes);
+    evaluation.checkpoint_path = checkpoint_path;
+    evaluation.checkpoint_interval = checkpoint_interval > 0 ? checkpoint_interval : 1;
+    pthread_mutex_init(&evaluation.checkpoint_mutex, NULL);
+    pthread_cond_init(&evaluation.checkpoint_condition, NULL);
+    evaluation.done = 0;
+
+    int ok = 1;
+    if (resume)
+    {
+        ok = read_checkpoint(&evaluation);
+    }
+    if (ok && statistics_prefix != NULL)
+    {
+        /* the map latencies are checkpointed, but a resumed run lists only the episodes it ran itself */
+        size_t filename_size = strlen(statistics_prefix) + 16;
+        char *filename = malloc(filename_size);
+        snprintf(filename, filename_size, "%s.latency.csv", statistics_prefix);
+        evaluation.latency_file = fopen(filename, "w");
+        if (evaluation.latency_file == NULL)
+        {
+            perror(filename);
+            ok = 0;
+        }
+        else
+        {
+            fprintf(evaluation.latency_file, "episode,decisions,p50,p99,p999,max\n");
+        }
+        free(filename);
+    }
+
+    pthread_t checkpoint_thread;
+    int checkpointing = ok && checkpoint_path != NULL &&
+                        pthread_create(&checkpoint_thread, NULL, run_checkpoint_thread, &evaluation) == 0;
+
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    struct EvaluationWorker *workers = malloc(nthreads * sizeof(struct EvaluationWorker));
+    int nstarted = 0;
+    for (int i = 0; i < nthreads && ok; i++)
+    {
+        workers[i].evaluation = &evaluation;
+        workers[i].shard = i;
+        if (pthread_create(&threads[i], NULL, run_evaluation_worker, &workers[i]) != 0)
+        {
+            break;
+        }
+        nstarted++;
+    }
+    if (nstarted == 0 && ok)
+    {
+        /* at least the calling thread runs the episodes */
+        workers[0].evaluation = &evaluation;
+        workers[0].shard = 0;
+        run_evaluation_worker(&workers[0]);
+    }
+    for (int i = 0; i < nstarted; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (checkpointing)
+    {
+        pthread_mutex_lock(&evaluation.checkpoint_mutex);
+        evaluation.done = 1;
+        pthread_cond_signal(&evaluation.checkpoint_condition);
+        pthread_mutex_unlock(&evaluation.checkpoint_mutex);
+        pthread_join(checkpoint_thread, NULL);
+        /* the final checkpoint lets a resumed run of a finished evaluation report its results */
+        ok = write_checkpoint(&evaluation) && ok;
+    }
+    ok = ok && !atomic_load(&evaluation.failed);
+
+    long successes = atomic_load(&evaluation.successes);
+    long nstates_visited = 0;
+    for (size_t i = 0; i < nvisited; i++)
+    {
+        nstates_visited += __builtin_popcountl(atomic_load(&evaluation.visited[i]));
+    }
+    if (ok)
+    {
+        printf("episodes: %ld successes: %ld states: %ld\n", nepisodes, successes, nstates_visited);
+        print_latencies(evaluation.latencies);
+    }
+    if (evaluation.latency_file != NULL)
+    {
+        ok = fclose(evaluation.latency_file) == 0 && ok;
+    }
+    if (ok && statistics_prefix != NULL)
+    {
+        ok = write_statistics(evaluation.statistics, statistics_prefix);
+    }
+
+    free(workers);
+    free(threads);
+    pthread_cond_destroy(&evaluation.checkpoint_condition);
+    pthread_mutex_destroy(&evaluation.checkpoint_mutex);
+    pthread_rwlock_destroy(&evaluation.commit_lock);
+    pthread_mutex_destroy(&evaluation.latency_mutex);
+    delete_latency_histogram(evaluation.latencies);
+    free(evaluation.visited);
+    free(evaluation.completed);
+    delete_statistics(evaluation.statistics);
+    delete_nn_model(nn_model);
+    return ok && successes == nepisodes;
+}
+
+NNBatch *create_nn_batch(int capacity)
+{
+    const int64_t dims[2] = {capacity, INPUT_SIZE};
+    NNBatch *nn_batch = malloc(sizeof(NNBatch));
+    nn_batch->capacity = capacity;
+    nn_batch->input_values[0] = TF_AllocateTensor(TF_FLOAT, dims, 2, capacity * INPUT_SIZE * sizeof(float));
+    nn_batch->status = TF_NewStatus();
+    nn_batch->q_values = malloc(capacity * OUTPUT_SIZE * sizeof(float));
+    return nn_batch;
+}
+
+float *get_nn_batch_input(NNBatch *nn_batch)
+{
+    return TF_TensorData(nn_batch->input_values[0]);
+}
+
+const float *get_nn_batch_output(const NNBatch *nn_batch)
+{
+    return nn_batch->q_values;
+}
+
+int call_nn_batch(const NNModel *nn_model, NNBatch *nn_batch, int nstates)
+{
+    TF_Tensor *input_values[1] = {nn_batch->input_values[0]};
+    if (nstates < nn_batch->capacity)
+    {
+        /* only the last batch of a sweep is partial, its rows are copied into a smaller tensor */
+        const int64_t dims[2] = {nstates, INPUT_SIZE};
+        input_values[0] = TF_AllocateTensor(TF_FLOAT, dims, 2, nstates * INPUT_SIZE * sizeof(float));
+        memcpy(TF_TensorData(input_values[0]), TF_TensorData(nn_batch->input_values[0]),
+               nstates * INPUT_SIZE * sizeof(float));
+    }
+
+    TF_Tensor *output_values[1] = {NULL};
+    TF_SessionRun(nn_model->session, NULL, &nn_model->input, input_values, 1, &nn_model->output,
+                  output_values, 1, NULL, 0, NULL, nn_batch->status);
+    if (input_values[0] != nn_batch->input_values[0])
+    {
+        TF_DeleteTensor(input_values[0]);
+    }
+    if (TF_GetCode(nn_batch->status) != TF_OK)
+    {
+        fprintf(stderr, "failed to run the model: %s\n", TF_Message(nn_batch->status));
+        return 0;
+    }
+    memcpy(nn_batch->q_values, TF_TensorData(output_values[0]), nstates * OUTPUT_SIZE * sizeof(float));
+    TF_DeleteTensor(output_values[0]);
+    return 1;
+}
+
+void delete_nn_batch(NNBatch *nn_batch)
+{
+    TF_DeleteTensor(nn_batch->input_values[0]);
+    TF_DeleteStatus(nn_batch->status);
+    free(nn_batch->q_values);
+    free(nn_batch);
+}
+
+int run_model_comparison(const Map *map, char **nn_model_directories, int nmodels, const char *output_prefix)
+{
+    NNModel **nn_models = malloc(nmodels * sizeof(NNModel *));
+    for (int i = 0; i < nmodels; i++)
+    {
+        nn_models[i] = load_nn_model(nn_model_directories[i]);
+        if (nn_models[i] == NULL)
+        {
+            for (int j = 0; j < i; j++)
+            {
+                delete_nn_model(nn_models[j]);
+            }
+            free(nn_models);
+            return 0;
+        }
+    }
+
+    int ok = 1;
+    FILE *disagreements = NULL;
+    char *filename = NULL;
+    if (output_prefix != NULL)
+    {
+        size_t filename_size = strlen(output_prefix) + 20;
+        filename = malloc(filename_size);
+        snprintf(filename, filename_size, "%s.disagreements.csv", output_prefix);
+        disagreements = fopen(filename, "w");
+        if (disagreements == NULL)
+        {
+            perror(filename);
+            ok = 0;
+        }
+        else
+        {
+            fprintf(disagreements, "x,y,vx,vy");
+            for (int i = 0; i < nmodels; i++)
+            {
+                fprintf(disagreements, ",ax%d,ay%d", i, i);
+            }
+            fprintf(disagreements, "\n");
+        }
+    }
+
+    NNBatch *nn_batch = create_nn_batch(COMPARISON_BATCH);
+    int *state_indices = malloc(COMPARISON_BATCH * sizeof(int));
+    /* validity of every acceleration, simulated once per state for all models */
+    unsigned char *valid = malloc(COMPARISON_BATCH * OUTPUT_SIZE);
+    int *actions = malloc(nmodels * COMPARISON_BATCH * sizeof(int));
+    /* states in which the action of the network alone does not crash in one step */
+    long *ncrash_free = calloc(nmodels, sizeof(long));
+    long nstates = 0;
+    long ndisagreements = 0;
+
+    int nstates_total = get_state_count(map);
+    int state_index = 0;
+    while (state_index < nstates_total && ok)
+    {
+        /* collect a batch of states and compute their features and successors once */
+        int nbatch = 0;
+        float *features = get_nn_batch_input(nn_batch);
+        for (; state_index < nstates_total && nbatch < COMPARISON_BATCH; state_index++)
+        {
+            Position position;
+            Velocity velocity;
+            get_indexed_state(map, state_index, &position, &velocity);
+            if (!is_valid_position(map, &position))
+            {
+                continue;
+            }
+            State state = {&position, &velocity};
+            fill_feature_values(map, &state, &features[nbatch * INPUT_SIZE]);
+            for (int action = 0; action < OUTPUT_SIZE; action++)
+            {
+                Acceleration acceleration = {action / 3 - 1, action % 3 - 1};
+                valid[nbatch * OUTPUT_SIZE + action] = is_valid_acceleration(map, &state, &acceleration);
+            }
+            state_indices[nbatch] = state_index;
+            nbatch++;
+        }
+        if (nbatch == 0)
+        {
+            break;
+        }
+
+        for (int i = 0; i < nmodels && ok; i++)
+        {
+            ok = call_nn_batch(nn_models[i], nn_batch, nbatch);
+            const float *q_values = get_nn_batch_output(nn_batch);
+            for (int j = 0; j < nbatch && ok; j++)
+            {
+                int action = get_max_q_value_index(&q_values[j * OUTPUT_SIZE]);
+                actions[i * COMPARISON_BATCH + j] = action;
+                ncrash_free[i] += valid[j * OUTPUT_SIZE + action];
+            }
+        }
+
+        for (int j = 0; j < nbatch && ok; j++)
+        {
+            int agree = 1;
+            for (int i = 1; i < nmodels; i++)
+            {
+                agree = agree && actions[i * COMPARISON_BATCH + j] == actions[j];
+            }
+            if (agree)
+            {
+                continue;
+            }
+            ndisagreements++;
+            if (disagreements != NULL)
+            {
+                Position position;
+                Velocity velocity;
+                get_indexed_state(map, state_indices[j], &position, &velocity);
+                fprintf(disagreements, "%d,%d,%d,%d", position.x, position.y, velocity.x, velocity.y);
+                for (int i = 0; i < nmodels; i++)
+                {
+                    int action = actions[i * COMPARISON_BATCH + j];
+                    fprintf(disagreements, ",%d,%d", action / 3 - 1, action % 3 - 1);
+                }
+                fprintf(disagreements, "\n");
+            }
+        }
+        nstates += nbatch;
+    }
+
+    if (disagreements != NULL)
+    {
+        int written = !ferror(disagreements);
+        written = fclose(disagreements) == 0 && written;
+        if (!written)
+        {
+            perror(filename);
+            ok = 0;
+        }
+    }
+    if (ok)
+    {
+        for (int i = 0; i < nmodels; i++)
+        {
+            printf("model: %s one-step crash-free: %ld/%ld (%.2f%%)\n", nn_model_directories[i],
+                   ncrash_free[i], nstates, nstates > 0 ? 100.0 * ncrash_free[i] / nstates : 0.0);
+        }
+        printf("states: %ld disagreements: %ld\n", nstates, ndisagreements);
+    }
+
+    free(filename);
+    free(ncrash_free);
+    free(actions);
+    free(valid);
+    free(state_indices);
+    delete_nn_batch(nn_batch);
+    for (int i = 0; i < nmodels; i++)
+    {
+        delete_nn_model(nn_models[i]);
+    }
+    free(nn_models);
+    return ok;
+}
+
+long get_elapsed_time(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+LatencyHistogram *create_latency_histogram()
+{
+    LatencyHistogram *histogram = malloc(sizeof(LatencyHistogram));
+    histogram->count = 0;
+    histogram->max = 0;
+    histogram->counts = calloc(LATENCY_BUCKETS, sizeof(long));
+    return histogram;
+}
+
+int get_latency_index(long latency)
+{
+    /* values below 2^LATENCY_SUB_BITS are exact, above each power of two is split into
+       2^LATENCY_SUB_BITS sub-buckets */
+    unsigned long value = latency > 0 ? latency : 0;
+    if (value < (1UL << LATENCY_SUB_BITS))
+    {
+        return value;
+    }
+    int magnitude = 63 - __builtin_clzl(value);
+    int bucket = magnitude - LATENCY_SUB_BITS + 1;
+    return (bucket << LATENCY_SUB_BITS) + (value >> (bucket - 1)) - (1 << LATENCY_SUB_BITS);
+}
+
+void record_latency(LatencyHistogram *histogram, long latency)
+{
+    histogram->counts[get_latency_index(latency)]++;
+    histogram->count++;
+    histogram->max = latency > histogram->max ? latency : histogram->max;
+}
+
+long get_latency_percentile(const LatencyHistogram *histogram, double fraction)
+{
+    long rank = (long)ceil(fraction * histogram->count);
+    rank = rank > 0 ? rank : 1;
+    long seen = 0;
+    for (int index = 0; index < LATENCY_BUCKETS; index++)
+    {
+        seen += histogram->counts[index];
+        if (seen >= rank)
+        {
+            /* the highest value of the sub-bucket, but never above the exact maximum */
+            int bucket = index >> LATENCY_SUB_BITS;
+            long value = index;
+            if (bucket > 0)
+            {
+                long sub_bucket = (index & ((1 << LATENCY_SUB_BITS) - 1)) + (1 << LATENCY_SUB_BITS);
+                value = ((sub_bucket + 1) << (bucket - 1)) - 1;
+            }
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+long get_latency_count(const LatencyHistogram *histogram)
+{
+    return histogram->count;
+}
+
+long get_latency_max(const LatencyHistogram *histogram)
+{
+    return histogram->max;
+}
+
+void merge_latency_histogram(LatencyHistogram *destination, const LatencyHistogram *source)
+{
+    for (int index = 0; index < LATENCY_BUCKETS; index++)
+    {
+        destination->counts[index] += source->counts[index];
+    }
+    destination->count += source->count;
+    destination->max = source->max > destination->max ? source->max : destination->max;
+}
+
+void reset_latency_histogram(LatencyHistogram *histogram)
+{
+    memset(histogram->counts, 0, LATENCY_BUCKETS * sizeof(long));
+    histogram->count = 0;
+    histogram->max = 0;
+}
+
+void delete_latency_histogram(LatencyHistogram *histogram)
+{
+    free(histogram->counts);
+    free(histogram);
+}
+
+void print_latencies(const LatencyHistogram *histogram)
+{
+    printf("decisions: %ld p50: %.1fus p99: %.1fus p99.9: %.1fus max: %.1fus\n", histogram->count,
+           get_latency_percentile(histogram, 0.5) / 1000.0, get_latency_percentile(histogram, 0.99) / 1000.0,
+           get_latency_percentile(histogram, 0.999) / 1000.0, histogram->max / 1000.0);
+}
+
+Map *generate_map(int width, int height, int corridor_width, double turn_density, double obstacle_fraction,
+                  int nstarts, int ngoals, unsigned long seed)
+{
+    if (corridor_width < 1 || width < corridor_width + 2 || height < corridor_width + 2 || turn_density < 0 ||
+        turn_density > 1 || obstacle_fraction < 0 || obstacle_fraction > 1 || nstarts < 1 || ngoals < 1)
+    {
+        fprintf(stderr, "invalid map parameters\n");
+        return NULL;
+    }
+
+    Map *map = create_map(width, height);
+    unsigned long random_state = seed;
+    /* carved cells in the order of carving, the path of the square is marked with '#' until the
+       obstacles are placed */
+    int *carved = malloc((long)width * height * sizeof(int));
+    int ncarved = 0;
+    long coverage = (long)(GENERATOR_COVERAGE * (width - 2) * (height - 2));
+    int x_limit = width - 1 - corridor_width;
+    int y_limit = height - 1 - corridor_width;
+    const int directions[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+    int x = 1 + get_random(&random_state) % x_limit;
+    int y = 1 + get_random(&random_state) % y_limit;
+    int direction = get_random(&random_state) % 4;
+    carve_square(map, x, y, corridor_width, carved, &ncarved);
+    for (long step = 0; ncarved < coverage && step < 16L * width * height; step++)
+    {
+        if ((get_random(&random_state) >> 11) * 0x1.0p-53 < turn_density)
+        {
+            direction = (direction + (get_random(&random_state) % 2 ? 1 : 3)) % 4;
+        }
+        /* turns away from the border, preferring a random side over turning back */
+        int side = get_random(&random_state) % 2 ? 1 : 3;
+        int turns[4] = {0, side, 4 - side, 2};
+        int heading = direction;
+        for (int turn = 0; turn < 4; turn++)
+        {
+            direction = (heading + turns[turn]) % 4;
+            int next_x = x + directions[direction][0];
+            int next_y = y + directions[direction][1];
+            if (next_x >= 1 && next_x <= x_limit && next_y >= 1 && next_y <= y_limit)
+            {
+                break;
+            }
+        }
+        x += directions[direction][0];
+        y += directions[direction][1];
+        carve_square(map, x, y, corridor_width, carved, &ncarved);
+    }
+
+    /* obstacles only replace cells beside the path, so the track stays connected */
+    for (int i = 0; i < ncarved; i++)
+    {
+        int cell_x = carved[i] / height;
+        int cell_y = carved[i] % height;
+        if (map->grid[cell_x][cell_y] == '.' && (get_random(&random_state) >> 11) * 0x1.0p-53 < obstacle_fraction)
+        {
+            map->grid[cell_x][cell_y] = 'x';
+        }
+    }
+    /* starts and goals lie on the path, whose cells are neighbors along the walk and never
+       obstacles, so every goal is reachable from every start */
+    int npath = 0;
+    for (int i = 0; i < ncarved; i++)
+    {
+        npath += map->grid[carved[i] / height][carved[i] % height] == '#';
+    }
+    if (npath < nstarts + ngoals)
+    {
+        fprintf(stderr, "the track has %d path cells for %d starts and %d goals\n", npath, nstarts, ngoals);
+        free(carved);
+        delete_map(map);
+        return NULL;
+    }
+    int nstarts_placed = 0;
+    for (int i = 0; i < ncarved && nstarts_placed < nstarts; i++)
+    {
+        char *cell = &map->grid[carved[i] / height][carved[i] % height];
+        if (*cell == '#')
+        {
+            *cell = 's';
+            nstarts_placed++;
+        }
+    }
+    int ngoals_placed = 0;
+    for (int i = ncarved - 1; i >= 0 && ngoals_placed < ngoals; i--)
+    {
+        char *cell = &map->grid[carved[i] / height][carved[i] % height];
+        if (*cell == '#')
+        {
+            *cell = 'g';
+            ngoals_placed++;
+        }
+    }
+    for (int i = 0; i < ncarved; i++)
+    {
+        char *cell = &map->grid[carved[i] / height][carved[i] % height];
+        if (*cell == '#')
+        {
+            *cell = '.';
+        }
+    }
+    free(carved);
+    index_map(map);
+    return map;
+}
+
+void carve_square(Map *map, int x, int y, int corridor_width, int *carved, int *ncarved)
+{
+    /* the first cell of the square is on the path of the square */
+    for (int i = 0; i < corridor_width; i++)
+    {
+        for (int j = 0; j < corridor_width; j++)
+        {
+            char *cell = &map->grid[x + i][y + j];
+            if (*cell == 'x')
+            {
+                carved[(*ncarved)++] = (x + i) * map->height + y + j;
+            }
+            if (i == 0 && j == 0)
+            {
+                *cell = '#';
+            }
+            else if (*cell == 'x')
+            {
+                *cell = '.';
+            }
+        }
+    }
+}
+
+double get_time()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+size_t get_map_size(const Map *map)
+{
+    return sizeof(Map) + map->width * (sizeof(char *) + map->height) +
+           (size_t)(map->width + 1) * (map->height + 1) * sizeof(int) +
+           (map->nstarts + map->ngoals) * (sizeof(Position *) + sizeof(Position));
+}
+
+long explore_map(const Map *map, int limit)
+{
+    /* breadth first search over the states reachable from the starts by any accelerations */
+    int nstates = get_state_count(map);
+    unsigned char *visited = calloc((nstates + 7) / 8, 1);
+    int *queue = malloc(limit * sizeof(int));
+    int nqueued = 0;
+    for (int i = 0; i < map->nstarts && nqueued < limit; i++)
+    {
+        Velocity velocity = {0, 0};
+        State state = {map->starts[i], &velocity};
+        int state_index = get_state_index(map, &state);
+        if (!(visited[state_index / 8] & (1 << state_index % 8)))
+        {
+            visited[state_index / 8] |= 1 << state_index % 8;
+            queue[nqueued++] = state_index;
+        }
+    }
+    for (int head = 0; head < nqueued; head++)
+    {
+        Position position;
+        Velocity velocity;
+        get_indexed_state(map, queue[head], &position, &velocity);
+        State state = {&position, &velocity};
+        for (int ax = -1; ax <= 1; ax++)
+        {
+            for (int ay = -1; ay <= 1; ay++)
+            {
+                Acceleration acceleration = {ax, ay};
+                State *next_state = get_next_state(map, &state, &acceleration);
+                if (next_state == NULL)
+                {
+                    continue;
+                }
+                int state_index = get_state_index(map, next_state);
+                delete_state(next_state);
+                if (nqueued < limit && !(visited[state_index / 8] & (1 << state_index % 8)))
+                {
+                    visited[state_index / 8] |= 1 << state_index % 8;
+                    queue[nqueued++] = state_index;
+                }
+            }
+        }
+    }
+    free(queue);
+    free(visited);
+    return nqueued;
+}
+
+int run_map_benchmark(int width, int height, int corridor_width, double turn_density, double obstacle_fraction,
+                      int nstarts, int ngoals, unsigned long seed, int nsizes)
+{
+    printf("width,height,area,generate_s,write_s,load_s,features_per_s,checks_per_s,explored,"
+           "explored_per_s,map_bytes,max_rss_kb\n");
+    Position *positions = malloc(BENCHMARK_SAMPLES * sizeof(Position));
+    Velocity *velocities = malloc(BENCHMARK_SAMPLES * sizeof(Velocity));
+    Acceleration *accelerations = malloc(BENCHMARK_SAMPLES * sizeof(Acceleration));
+    int success = 1;
+    for (int size = 0; size < nsizes && success; size++)
+    {
+        /* the area doubles with every size */
+        int size_width = (int)(width * pow(2, size / 2.0) + 0.5);
+        int size_height = (int)(height * pow(2, size / 2.0) + 0.5);
+        double start = get_time();
+        Map *generated_map = generate_map(size_width, size_height, corridor_width, turn_density,
+                                          obstacle_fraction, nstarts, ngoals, seed);
+        if (generated_map == NULL)
+        {
+            success = 0;
+            break;
+        }
+        double generate_time = get_time() - start;
+
+        FILE *file = tmpfile();
+        if (file == NULL)
+        {
+            perror("tmpfile");
+            delete_map(generated_map);
+            success = 0;
+            break;
+        }
+        start = get_time();
+        success = write_map(generated_map, file) && fflush(file) == 0;
+        double write_time = get_time() - start;
+        rewind(file);
+        start = get_time();
+        Map *map = read_map(file);
+        double load_time = get_time() - start;
+        fclose(file);
+        delete_map(generated_map);
+        if (map == NULL)
+        {
+            success = 0;
+            break;
+        }
+
+        /* random track states drawn before timing */
+        unsigned long random_state = seed;
+        for (int i = 0; i < BENCHMARK_SAMPLES; i++)
+        {
+            do
+            {
+                positions[i].x = get_random(&random_state) % map->width;
+                positions[i].y = get_random(&random_state) % map->height;
+            } while (!is_valid_position(map, &positions[i]));
+            velocities[i].x = (int)(get_random(&random_state) % (2 * velocity_limit_x + 1)) - velocity_limit_x;
+            velocities[i].y = (int)(get_random(&random_state) % (2 * velocity_limit_y + 1)) - velocity_limit_y;
+            accelerations[i].x = (int)(get_random(&random_state) % 3) - 1;
+            accelerations[i].y = (int)(get_random(&random_state) % 3) - 1;
+        }
+
+        /* the timed loops write to volatile memory, so they cannot be optimized away */
+        volatile float feature_values[INPUT_SIZE];
+        start = get_time();
+        for (int i = 0; i < BENCHMARK_SAMPLES; i++)
+        {
+            State state = {&positions[i], &velocities[i]};
+            fill_feature_values(map, &state, (float *)feature_values);
+        }
+        double feature_time = get_time() - start;
+
+        volatile long nvalid = 0;
+        start = get_time();
+        for (int i = 0; i < BENCHMARK_SAMPLES; i++)
+        {
+            State state = {&positions[i], &velocities[i]};
+            nvalid += is_valid_acceleration(map, &state, &accelerations[i]);
+        }
+        double check_time = get_time() - start;
+
+        start = get_time();
+        long nexplored = explore_map(map, BENCHMARK_EXPLORATION_LIMIT);
+        double explore_time = get_time() - start;
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        printf("%d,%d,%ld,%.6f,%.6f,%.6f,%.0f,%.0f,%ld,%.0f,%zu,%ld\n", map->width, map->height,
+               (long)map->width * map->height, generate_time, write_time, load_time,
+               BENCHMARK_SAMPLES / feature_time, BENCHMARK_SAMPLES / check_time,
+               nexplored, nexplored / explore_time, get_map_size(map), usage.ru_maxrss);
+        fflush(stdout);
+        delete_map(map);
+    }
+    free(positions);
+    free(velocities);
+    free(accelerations);
+    return success;
+}
+
+int run_dataset_export(const Map *map, const char *nn_model_directory, const char *filename, int nthreads,
+                       long nepisodes, unsigned long seed, int step_limit, int look_ahead_steps,
+                       int safety_distance)
+{
+    if (nthreads < 1 || (nepisodes > 0 && map->nstarts == 0))
+    {
+        return 0;
+    }
+    if (nepisodes > INT32_MAX)
+    {
+        fprintf(stderr, "episode indices of a dataset are 32 bit integers\n");
+        return 0;
+    }
+
+    NNModel *nn_model = load_nn_model(nn_model_directory);
+    if (nn_model == NULL)
+    {
+        return 0;
+    }
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror(filename);
+        delete_nn_model(nn_model);
+        return 0;
+    }
+
+    struct DatasetExport export;
+    export.map = map;
+    export.nn_model = nn_model;
+    export.fd = fd;
+    export.nepisodes = nepisodes;
+    export.seed = seed;
+    export.step_limit = step_limit;
+    export.look_ahead_steps = look_ahead_steps;
+    export.safety_distance = safety_distance;
+    atomic_init(&export.next_item, 0);
+    atomic_init(&export.next_chunk, 0);
+    atomic_init(&export.failed, 0);
+    /* every thread leaves at most one chunk partially filled */
+    long nrows_limit = nepisodes > 0 ? nepisodes * step_limit : get_state_count(map);
+    export.chunk_limit = (nrows_limit + DATASET_CHUNK_ROWS - 1) / DATASET_CHUNK_ROWS + nthreads;
+    export.chunk_rows = calloc(export.chunk_limit, sizeof(int64_t));
+
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    int nstarted = 0;
+    for (; nstarted < nthreads; nstarted++)
+    {
+        if (pthread_create(&threads[nstarted], NULL, run_export_worker, &export) != 0)
+        {
+            atomic_store(&export.failed, 1);
+            break;
+        }
+    }
+    for (int i = 0; i < nstarted; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    int ok = !atomic_load(&export.failed);
+    long nchunks = atomic_load(&export.next_chunk);
+    int64_t nrows = 0;
+    for (long k = 0; k < nchunks; k++)
+    {
+        nrows += export.chunk_rows[k];
+    }
+    if (ok)
+    {
+        int64_t counts_offset = DATASET_HEADER_SIZE + nchunks * DATASET_CHUNK_SIZE;
+        int64_t header[DATASET_HEADER_SIZE / sizeof(int64_t)] = {
+            DATASET_MAGIC, DATASET_VERSION, DATASET_COLUMNS, DATASET_CHUNK_ROWS, nchunks, nrows, counts_offset};
+        ok = pwrite_fully(fd, export.chunk_rows, nchunks * sizeof(int64_t), counts_offset) &&
+             pwrite_fully(fd, header, sizeof(header), 0);
+    }
+    ok = close(fd) == 0 && ok;
+    if (ok)
+    {
+        printf("rows: %ld chunks: %ld\n", (long)nrows, nchunks);
+    }
+
+    free(threads);
+    free(export.chunk_rows);
+    delete_nn_model(nn_model);
+    return ok;
+}
+
+void *run_export_worker(void *argument)
+{
+    struct DatasetExport *export = argument;
+    const Map *map = export->map;
+    NNContext *nn_context = create_nn_context(export->nn_model);
+    struct DatasetChunk chunk = {0, calloc(DATASET_COLUMNS * DATASET_CHUNK_ROWS, sizeof(float))};
+    int nstates = get_state_count(map);
+    while (!atomic_load(&export->failed))
+    {
+        long item = atomic_fetch_add(&export->next_item, 1);
+        if (export->nepisodes > 0)
+        {
+            if (item >= export->nepisodes)
+            {
+                break;
+            }
+            /* the start positions of run_evaluation_worker */
+            unsigned long random_state = export->seed ^ (item * 0xd1b54a32d192ed03UL);
+            Velocity start_velocity = {0, 0};
+            State initial_state = {map->starts[get_random(&random_state) % map->nstarts], &start_velocity};
+            const State *state = &initial_state;
+            for (int step = 0; step < export->step_limit && !is_goal_state(map, state); step++)
+            {
+                Acceleration *acceleration = export_state(export, &chunk, nn_context, state, item, step);
+                State *next_state = acceleration != NULL ? execute_acceleration(map, state, acceleration) : NULL;
+                delete_acceleration(acceleration);
+                if (state != &initial_state)
+                {
+                    delete_state((State *)state);
+                }
+                state = next_state;
+                if (state == NULL)
+                {
+                    break;
+                }
+            }
+            if (state != NULL && state != &initial_state)
+            {
+                delete_state((State *)state);
+            }
+        }
+        else
+        {
+            long first = item * DATASET_CHUNK_ROWS;
+            if (first >= nstates)
+            {
+                break;
+            }
+            long last = first + DATASET_CHUNK_ROWS < nstates ? first + DATASET_CHUNK_ROWS : nstates;
+            for (long state_index = first; state_index < last; state_index++)
+            {
+                Position position;
+                Velocity velocity;
+                get_indexed_state(map, state_index, &position, &velocity);
+                if (!is_valid_position(map, &position))
+                {
+                    continue;
+                }
+                State state = {&position, &velocity};
+                Acceleration *acceleration = export_state(export, &chunk, nn_context, &state, -1, -1);
+                delete_acceleration(acceleration);
+            }
+        }
+    }
+    if (chunk.nrows > 0 && !flush_chunk(export, &chunk))
+    {
+        atomic_store(&export->failed, 1);
+    }
+    free(chunk.columns);
+    delete_nn_context(nn_context);
+    return NULL;
+}
+
+Acceleration *export_state(struct DatasetExport *export, struct DatasetChunk *chunk, NNContext *nn_context,
+                           const State *state, long episode, int step)
+{
+    /* compute_safeguarded_acceleration, keeping the features and Q-values of the state before the
+       look ahead overwrites them */
+    Acceleration *acceleration = call_nn_context(nn_context, export->map, state);
+    if (acceleration == NULL)
+    {
+        atomic_store(&export->failed, 1);
+        return NULL;
+    }
+    float *row = chunk->columns + chunk->nrows;
+    const float *feature_values = TF_TensorData(nn_context->input_values[0]);
+    for (int i = 0; i < INPUT_SIZE; i++)
+    {
+        row[(DATASET_FEATURES + i) * DATASET_CHUNK_ROWS] = feature_values[i];
+    }
+    for (int i = 0; i < OUTPUT_SIZE; i++)
+    {
+        row[(DATASET_Q_VALUES + i) * DATASET_CHUNK_ROWS] = nn_context->q_values[i];
+    }
+
+    Acceleration *safeguarded_acceleration;
+    if (look_ahead_check(export->map, state, nn_context, export->look_ahead_steps, export->safety_distance))
+    {
+        safeguarded_acceleration = create_acceleration(acceleration->x, acceleration->y);
+    }
+    else
+    {
+        safeguarded_acceleration = get_negated_acceleration(acceleration);
+    }
+    row[DATASET_ACTION * DATASET_CHUNK_ROWS] = acceleration->x;
+    row[(DATASET_ACTION + 1) * DATASET_CHUNK_ROWS] = acceleration->y;
+    row[DATASET_SAFEGUARDED_ACTION * DATASET_CHUNK_ROWS] = safeguarded_acceleration->x;
+    row[(DATASET_SAFEGUARDED_ACTION + 1) * DATASET_CHUNK_ROWS] = safeguarded_acceleration->y;
+    /* integers are stored in the bits of their columns, a float is exact only up to 2^24 */
+    int32_t index_values[2] = {episode, step};
+    memcpy(&row[DATASET_EPISODE * DATASET_CHUNK_ROWS], &index_values[0], sizeof(int32_t));
+    memcpy(&row[DATASET_STEP * DATASET_CHUNK_ROWS], &index_values[1], sizeof(int32_t));
+    delete_acceleration(acceleration);
+
+    chunk->nrows++;
+    if (chunk->nrows == DATASET_CHUNK_ROWS && !flush_chunk(export, chunk))
+    {
+        atomic_store(&export->failed, 1);
+        delete_acceleration(safeguarded_acceleration);
+        return NULL;
+    }
+    return safeguarded_acceleration;
+}
+
+int flush_chunk(struct DatasetExport *export, struct DatasetChunk *chunk)
+{
+    /* every chunk has its own place in the file, so threads write without coordination */
+    long k = atomic_fetch_add(&export->next_chunk, 1);
+    if (k >= export->chunk_limit)
+    {
+        fprintf(stderr, "too many dataset chunks\n");
+        return 0;
+    }
+    if (chunk->nrows < DATASET_CHUNK_ROWS)
+    {
+        for (int i = 0; i < DATASET_COLUMNS; i++)
+        {
+            memset(chunk->columns + i * DATASET_CHUNK_ROWS + chunk->nrows, 0,
+                   (DATASET_CHUNK_ROWS - chunk->nrows) * sizeof(float));
+        }
+    }
+    export->chunk_rows[k] = chunk->nrows;
+    chunk->nrows = 0;
+    return pwrite_fully(export->fd, chunk->columns, DATASET_CHUNK_SIZE, DATASET_HEADER_SIZE + k * DATASET_CHUNK_SIZE);
+}
+
+int pwrite_fully(int fd, const void *buffer, size_t size, off_t offset)
+{
+    const char *bytes = buffer;
+    while (size > 0)
+    {
+        ssize_t nwritten = pwrite(fd, bytes, size, offset);
+        if (nwritten < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (nwritten <= 0)
+        {
+            perror("pwrite");
+            return 0;
+        }
+        bytes += nwritten;
+        size -= nwritten;
+        offset += nwritten;
+    }
+    return 1;
 }